@@ -1,7 +1,7 @@
 CC = gcc
 LD = gcc
-CFLAGS = -std=c17 -Wall -Wextra -g -Ofast -march=native -pipe -flto
-LDFLAGS = -flto
+CFLAGS = -std=c17 -Wall -Wextra -g -Ofast -march=native -pipe -flto -pthread
+LDFLAGS = -flto -pthread -lm
 
 PREFIX = /usr/local
 MANPREFIX = $(PREFIX)/share/man
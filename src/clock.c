@@ -0,0 +1,16 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "bit.h"
+#include "clock.h"
+
+/*
+ * The wall clock time in milliseconds, used for the time limits of the search
+ * and to report how long a search, perft or bench took.
+ */
+u64 clock_get_time_in_ms(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (u64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,6 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+u64 clock_get_time_in_ms(void);
+
+#endif
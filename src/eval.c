@@ -21,18 +21,6 @@ enum piece_values {
 	PIECE_VALUE_KING = 10000,
 };
 
-/*
- * These tables store the number of possible moves for a piece when the board
- * contains only that piece, so no occupancy for sliding pieces.
- */
-static i8 white_pawn_number_of_possible_moves[64];
-static i8 black_pawn_number_of_possible_moves[64];
-static i8 knight_number_of_possible_moves[64];
-static i8 rook_number_of_possible_moves[64];
-static i8 bishop_number_of_possible_moves[64];
-static i8 queen_number_of_possible_moves[64];
-static i8 king_number_of_possible_moves[64];
-
 /*
  * The square tables are indexed by the square number so even though the code
  * looks like a chess board the top row is actually the rank 1.
@@ -139,43 +127,6 @@ const int capture_attacker_score_table[6] = {
 	[PIECE_TYPE_QUEEN ] = PIECE_VALUE_KNIGHT,
 	[PIECE_TYPE_KING  ] = PIECE_VALUE_PAWN,
 };
-static int average_mvv_lva_score;
-
-static int factorial(int n)
-{
-	if (n == 0)
-		return 1;
-	return n * factorial(n - 1);
-}
-
-/*
- * Initialize the average MVV-LVA score considering all possible pairs of
- * attacker and target.
- */
-static int init_average_mvv_lva_score(void)
-{
-	const size_t num_pieces = 6;
-	int sum = 0;
-	for (size_t i = 0; i < num_pieces; ++i) {
-		for (size_t j = 0; j < num_pieces; ++j)
-			sum += capture_target_score_table[i] + capture_attacker_score_table[j];
-	}
-	int combinations = factorial(num_pieces) / (factorial(2) * factorial(num_pieces - 2));
-	return sum / combinations;
-}
-
-static void init_possible_moves_table(void)
-{
-	for (Square sq = A1; sq <= H8; ++sq) {
-		white_pawn_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_PAWN, sq);
-		black_pawn_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_BLACK_PAWN, sq);
-		knight_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_KNIGHT, sq);
-		rook_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_ROOK, sq);
-		bishop_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_BISHOP, sq);
-		queen_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_QUEEN, sq);
-		king_number_of_possible_moves[sq] = movegen_get_number_of_possible_moves(PIECE_WHITE_KING, sq);
-	}
-}
 
 /*
  * The square tables for black pieces has the same values as the ones for white
@@ -315,81 +266,108 @@ int eval_evaluate(const Position *pos)
 	       mobility_weight * mobility + positioning;
 }
 
-int eval_get_average_mvv_lva_score(void)
+/*
+ * Static exchange evaluation: return true if the material balance of the
+ * capture sequence on the target square of the move, where each side captures
+ * with its least valuable piece and can stop whenever it's better not to
+ * continue, is at least threshold for the side making the move.
+ *
+ * Instead of building the whole swap list, the balance is compared with the
+ * threshold at each step, which allows returning as soon as the outcome is
+ * clear. The attackers are found again after each capture with the capturing
+ * piece removed from the occupancy, which reveals the sliders behind it.
+ * Pins and promotions are ignored.
+ */
+bool eval_see(const Position *pos, Move move, int threshold)
 {
-	return average_mvv_lva_score;
+	const Square from = move_get_origin(move);
+	const Square to = move_get_target(move);
+	const MoveType type = move_get_type(move);
+	if (type == MOVE_KING_CASTLE || type == MOVE_QUEEN_CASTLE)
+		return threshold <= 0;
+
+	u64 occ = pos_get_color_bitboard(pos, COLOR_WHITE) | pos_get_color_bitboard(pos, COLOR_BLACK);
+	int captured_value = 0;
+	if (type == MOVE_EP_CAPTURE) {
+		captured_value = capture_target_score_table[PIECE_TYPE_PAWN];
+		occ ^= U64(1) << (pos_get_side_to_move(pos) == COLOR_WHITE ? to - 8 : to + 8);
+	} else if (move_is_capture(move)) {
+		captured_value = capture_target_score_table[pos_get_piece_type(pos_get_piece_at(pos, to))];
+	}
+
+	/* The balance if the opponent doesn't recapture. */
+	int swap = captured_value - threshold;
+	if (swap < 0)
+		return false;
+	/* The balance if the opponent recaptures the moved piece for free. */
+	const PieceType moved = pos_get_piece_type(pos_get_piece_at(pos, from));
+	swap = capture_target_score_table[moved] - swap;
+	if (swap <= 0)
+		return true;
+
+	occ ^= (U64(1) << from) | (U64(1) << to);
+	Color c = pos_get_side_to_move(pos);
+	u64 attackers = movegen_attackers_to(to, occ, pos);
+	bool result = true;
+	for (;;) {
+		c = !c;
+		attackers &= occ;
+		const u64 own_attackers = attackers & pos_get_color_bitboard(pos, c);
+		if (!own_attackers)
+			break;
+		result = !result;
+
+		PieceType pt = PIECE_TYPE_PAWN;
+		u64 bb = 0;
+		const PieceType by_value[] = {
+			PIECE_TYPE_PAWN, PIECE_TYPE_KNIGHT, PIECE_TYPE_BISHOP,
+			PIECE_TYPE_ROOK, PIECE_TYPE_QUEEN, PIECE_TYPE_KING,
+		};
+		for (size_t i = 0; i < sizeof(by_value) / sizeof(by_value[0]); ++i) {
+			pt = by_value[i];
+			bb = own_attackers & pos_get_type_bitboard(pos, pt);
+			if (bb)
+				break;
+		}
+		/* The king can only capture if the opponent has no attackers
+		 * left. */
+		if (pt == PIECE_TYPE_KING)
+			return attackers & ~pos_get_color_bitboard(pos, c) ? !result : result;
+
+		swap = capture_target_score_table[pt] - swap;
+		if (swap < result)
+			break;
+		occ ^= U64(1) << get_index_of_first_bit(bb);
+		attackers = movegen_attackers_to(to, occ, pos);
+	}
+	return result;
 }
 
+/*
+ * Promotions are scored as if the pawn captured the piece it is promoted to,
+ * since that's about how much material is gained, so a quiet promotion to a
+ * queen is ordered like a capture of a queen.
+ */
 int eval_compute_mvv_lva_score(Move move, const Position *pos)
 {
 	const Square target = move_get_target(move);
 	const Square origin = move_get_origin(move);
-	const Piece attacked_piece = pos_get_piece_at(pos, target);
+	const MoveType type = move_get_type(move);
 	const Piece attacker_piece = pos_get_piece_at(pos, origin);
-	const PieceType attacked = pos_get_piece_type(attacked_piece);
 	const PieceType attacker = pos_get_piece_type(attacker_piece);
 
-	return capture_target_score_table[attacked] + capture_attacker_score_table[attacker];
-}
-
-int eval_evaluate_move(Move move, Position *pos)
-{
-	const Square target = move_get_target(move);
-	const Square origin = move_get_origin(move);
-	const Piece piece = pos_get_piece_at(pos, origin);
-	const PieceType piece_type = pos_get_piece_type(piece);
-	const Color piece_color = pos_get_side_to_move(pos);
-
-	int score = 0;
-
-	if (move_get_type(move) == MOVE_CAPTURE)
-		score += eval_compute_mvv_lva_score(move, pos);
-
-	/* Temporarily remove moving piece so it's not counted as an attacking
-	 * piece. */
-	pos_remove_piece(pos, origin);
-	if (movegen_is_square_attacked(target, !piece_color, pos))
-		score -= capture_target_score_table[piece_type];
-	else
-		score += 1;
-	pos_place_piece(pos, origin, piece);
-	if (movegen_is_square_attacked(origin, !piece_color, pos))
-		score += capture_target_score_table[piece_type];
-
-	static const i8 *number_of_possible_moves[7] = {
-		[PIECE_TYPE_KNIGHT] = knight_number_of_possible_moves,
-		[PIECE_TYPE_ROOK  ] = rook_number_of_possible_moves,
-		[PIECE_TYPE_BISHOP] = bishop_number_of_possible_moves,
-		[PIECE_TYPE_QUEEN ] = queen_number_of_possible_moves,
-		[PIECE_TYPE_KING  ] = king_number_of_possible_moves,
-	};
-	if (piece_type == PIECE_TYPE_PAWN)
-		score += piece_color == COLOR_WHITE ? pos_get_rank_of_square(target) : (RANK_7 - pos_get_rank_of_square(target));
-	else
-		score += number_of_possible_moves[piece_type][target];
-
-	const i8 *square_tables[] = {
-		[PIECE_WHITE_PAWN  ] = white_pawn_sq_table,   [PIECE_BLACK_PAWN  ] = black_pawn_sq_table,
-		[PIECE_WHITE_KNIGHT] = white_knight_sq_table, [PIECE_BLACK_KNIGHT] = black_knight_sq_table,
-		[PIECE_WHITE_BISHOP] = white_bishop_sq_table, [PIECE_BLACK_BISHOP] = black_bishop_sq_table,
-		[PIECE_WHITE_ROOK  ] = white_rook_sq_table,   [PIECE_BLACK_ROOK  ] = black_rook_sq_table,
-		[PIECE_WHITE_QUEEN ] = white_queen_sq_table,  [PIECE_BLACK_QUEEN ] = black_queen_sq_table,
-	};
-
-	if (piece_type == PIECE_TYPE_KING) {
-		const i8 *king_square_tables[] = {
-			[PIECE_WHITE_KING] = white_king_middle_game_sq_table,
-			[PIECE_BLACK_KING] = black_king_middle_game_sq_table,
-		};
-		if (pos_get_number_of_pieces_of_color(pos, COLOR_WHITE) < 5)
-			king_square_tables[PIECE_WHITE_KING] = white_king_end_game_sq_table;
-		if (pos_get_number_of_pieces_of_color(pos, COLOR_BLACK) < 5)
-			king_square_tables[PIECE_BLACK_KING] = black_king_end_game_sq_table;
-		score += king_square_tables[piece][target];
-		score -= king_square_tables[piece][origin];
-	} else {
-		score += square_tables[piece][target];
-		score -= square_tables[piece][origin];
+	int score = capture_attacker_score_table[attacker];
+	/* The target square of en passant captures is empty. */
+	if (type == MOVE_EP_CAPTURE) {
+		score += capture_target_score_table[PIECE_TYPE_PAWN];
+	} else if (move_is_capture(move)) {
+		const Piece attacked_piece = pos_get_piece_at(pos, target);
+		score += capture_target_score_table[pos_get_piece_type(attacked_piece)];
+	}
+	if (move_is_promotion(move)) {
+		const PieceType promoted_to = PIECE_TYPE_KNIGHT +
+		                              (type - MOVE_KNIGHT_PROMOTION) % 4;
+		score += capture_target_score_table[promoted_to];
 	}
 
 	return score;
@@ -397,7 +375,5 @@ int eval_evaluate_move(Move move, Position *pos)
 
 void eval_init(void)
 {
-	init_possible_moves_table();
 	init_square_tables();
-	init_average_mvv_lva_score();
 }
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <ctype.h>
 #include <stdbool.h>
@@ -12,11 +13,29 @@
 #include "move.h"
 #include "movegen.h"
 
-int main(void)
+/*
+ * Running "athena bench [depth]" runs the bench command and exits, so builds
+ * can be compared without a UCI session.
+ */
+int main(int argc, char **argv)
 {
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		char cmd[32];
+		snprintf(cmd, sizeof(cmd), "bench %s", argc > 2 ? argv[2] : "");
+		uci_interpret(cmd);
+		uci_interpret("quit");
+		return EXIT_SUCCESS;
+	}
+
 	bool quit = false;
 	while (!quit) {
 		char *str = uci_receive();
+		if (!str) {
+			/* The GUI is gone, so there's nobody to talk to. */
+			if (feof(stdin))
+				quit = !uci_interpret("quit");
+			continue;
+		}
 		quit = !uci_interpret(str);
 		free(str);
 	}
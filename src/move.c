@@ -6,7 +6,6 @@
 #include "bit.h"
 #include "pos.h"
 #include "move.h"
-#include "movegen.h"
 
 static const Piece promotion_table[][4] = {
 	[COLOR_WHITE][MOVE_KNIGHT_PROMOTION - 6] = PIECE_WHITE_KNIGHT,
@@ -27,6 +26,11 @@ static const CastlingSide castling_table[] = {
  * Since the functions to do and undo moves do basically the same thing, I
  * created this macro. The conditionals that check the choice of doing or
  * undoing are optimized out.
+ *
+ * When undoing a move the side to move is flipped before the irreversible state
+ * is backtracked, this way the change to the Zobrist key is discarded along
+ * with the irreversible state and the key of the previous position is
+ * restored as it was.
  */
 #define ACTION_FOR_MOVE(do_or_undo)\
 const int choice_do = 0;\
@@ -56,9 +60,9 @@ else if (type >= MOVE_KNIGHT_PROMOTION && type <= MOVE_QUEEN_PROMOTION)\
 else if (type >= MOVE_KNIGHT_PROMOTION_CAPTURE)\
 	do_or_undo##_promotion(pos, from, to, promotion_table[color][type - 10], 1);\
 \
+pos_flip_side_to_move(pos);\
 if (choice_##do_or_undo == choice_undo)\
-	pos_backtrack_irreversible_state(pos);\
-pos_flip_side_to_move(pos);
+	pos_backtrack_irreversible_state(pos);
 
 static void do_promotion(Position *pos, Square from, Square to,
 			 Piece promoted_to, int is_capture)
@@ -327,25 +331,6 @@ static void undo_quiet(Position *pos, Square from, Square to, Piece piece)
 		pos_decrement_fullmove_counter(pos);
 }
 
-/*
- * This function returns 1 is a move is legal and 0 otherwise. Although the
- * pos argument is non-const the original position is restored so it is safe to
- * call it. A const argument would require copying the position to make changes
- * in the copy and that would be slower.
- */
-bool move_is_legal(Position *pos, Move move)
-{
-	const Color color = pos_get_side_to_move(pos);
-	move_do(pos, move);
-	const Square sq = pos_get_king_square(pos, color);
-	if (movegen_is_square_attacked(sq, !color, pos)) {
-		move_undo(pos, move);
-		return false;
-	}
-	move_undo(pos, move);
-	return true;
-}
-
 void move_undo(Position *pos, Move move)
 {
 	ACTION_FOR_MOVE(undo);
@@ -356,6 +341,27 @@ void move_do(Position *pos, Move move)
 	ACTION_FOR_MOVE(do);
 }
 
+/*
+ * A null move passes the turn to the opponent without changing the board. It
+ * isn't a legal move, the search uses it to find out how good a position is
+ * even if the side to move does nothing. Like any move that isn't a capture
+ * or a pawn move it increments the halfmove clock and it removes the
+ * possibility of an en passant capture.
+ */
+void move_do_null(Position *pos)
+{
+	pos_start_new_irreversible_state(pos);
+	pos_unset_enpassant(pos);
+	pos_increment_halfmove_clock(pos);
+	pos_flip_side_to_move(pos);
+}
+
+void move_undo_null(Position *pos)
+{
+	pos_flip_side_to_move(pos);
+	pos_backtrack_irreversible_state(pos);
+}
+
 Move move_new(Square from, Square to, MoveType type)
 {
 	return (type & 0xf) << 12 | (to & 0x3f) << 6 | (from & 0x3f);
@@ -373,6 +379,11 @@ bool move_is_capture(Move move)
 	       type == MOVE_QUEEN_PROMOTION_CAPTURE;
 }
 
+bool move_is_promotion(Move move)
+{
+	return move_get_type(move) >= MOVE_KNIGHT_PROMOTION;
+}
+
 Square move_get_origin(Move move)
 {
 	return move & 0x3f;
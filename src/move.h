@@ -32,11 +32,13 @@ typedef enum move_type {
 
 typedef u16 Move;
 
-bool move_is_legal(Position *pos, Move move);
 void move_undo(Position *pos, Move move);
 void move_do(Position *pos, Move move);
+void move_undo_null(Position *pos);
+void move_do_null(Position *pos);
 Move move_new(Square from, Square to, MoveType type);
 bool move_is_capture(Move move);
+bool move_is_promotion(Move move);
 Square move_get_origin(Move move);
 Square move_get_target(Move move);
 MoveType move_get_type(Move move);
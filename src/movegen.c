@@ -20,20 +20,6 @@ typedef struct magic {
 	int shift;
 } Magic;
 
-/*
- * This stack is used to store moves during move generation, I created it just
- * to avoid repeating the code to add a new move. The list of moves used by the
- * stack, referenced by ptr, is guaranteed to not have holes (missing moves
- * between two moves) so it can be normally used like any list. The index
- * always points to the next empty slot, which will be used to store the next
- * move. Moves cannot be removed, only added.
- */
-typedef struct move_stack {
-	Move *ptr;
-	size_t capacity;
-	size_t index;
-} MoveStack;
-
 /*
  * The bitboards for each rank and file contain all the squares of a rank or
  * file, and they are used to generate the ray bitboards. A ray bitboard
@@ -83,6 +69,16 @@ static u64 rook_attack_table[0x19000];
 static u64 bishop_attack_table[0x1480];
 static u64 king_attack_table[64];
 
+/*
+ * The between bitboards contain the squares between two squares on the same
+ * rank, file or diagonal, not including the two squares, and the line
+ * bitboards contain the whole line crossing both squares. Both are empty when
+ * the squares are not aligned. They are used to find pins and to block checks
+ * during legal move generation.
+ */
+static u64 between_bitboards[64][64];
+static u64 line_bitboards[64][64];
+
 /*
  * Right shift bits, removing bits that are pushed to file H.
  */
@@ -327,6 +323,25 @@ static void init_king_attacks(void)
 	}
 }
 
+static void init_lines(void)
+{
+	for (Square from = A1; from <= H8; ++from) {
+		for (Direction dir = NORTH; dir <= NORTHWEST; ++dir) {
+			const Direction opposite = (dir + 4) % 8;
+			const u64 line = ray_bitboards[dir][from] |
+			                 ray_bitboards[opposite][from] |
+			                 U64(0x1) << from;
+			u64 ray = ray_bitboards[dir][from];
+			while (ray) {
+				const Square to = get_index_of_first_bit_and_unset(&ray);
+				between_bitboards[from][to] = ray_bitboards[dir][from] &
+				                              ray_bitboards[opposite][to];
+				line_bitboards[from][to] = line;
+			}
+		}
+	}
+}
+
 static u64 get_single_push(Square sq, u64 occ, Color c)
 {
 	const u64 bb = U64(0x1) << sq;
@@ -393,45 +408,45 @@ static u64 get_queen_attacks(Square sq, u64 occ)
 	return get_rook_attacks(sq, occ) | get_bishop_attacks(sq, occ);
 }
 
-/*
- * The chess positions with the most number of legal moves for a side that I
- * know of are
- * "R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1" and
- * "3Q4/1Q4Q1/4Q3/2Q4R/Q4Q2/3Q4/1Q4Rp/1K1BBNNk w - - 0 1"
- * with 218 legal moves for white, so the maximum number of legal or illegal
- * moves for any position must be around that value. Therefore the stack of
- * moves starts with capacity 256 which is the closest power of 2.
- */
-static void init_move_stack(MoveStack *stack)
+static void push_move(MoveList *list, Move move)
 {
-	const size_t initial_capacity = 2 << 8;
-	stack->capacity = initial_capacity;
-	stack->ptr = malloc(stack->capacity * sizeof(Move));
-	stack->index = 0;
+	list->moves[list->len] = move;
+	++list->len;
 }
 
-static void push_move(MoveStack *stack, Move move)
+static bool is_promotion_square(Square sq, Color c)
 {
-	if (stack->index == stack->capacity) {
-		stack->capacity <<= 2;
-		Move *const tmp = realloc(stack->ptr, stack->capacity * sizeof(Move));
-		if (!tmp) {
-			fprintf(stderr, "Could not allocate memory.");
-			exit(1);
-		}
-		stack->ptr = tmp;
+	return c == COLOR_WHITE ? sq >= A8 : sq <= H1;
+}
+
+/*
+ * Add a pawn move that is not a capture, or all of the promotions if the pawn
+ * reaches the last rank.
+ */
+static void add_pawn_push(MoveList *list, Square from, Square to, Color c)
+{
+	if (is_promotion_square(to, c)) {
+		for (MoveType move_type = MOVE_KNIGHT_PROMOTION;
+		     move_type <= MOVE_QUEEN_PROMOTION; ++move_type)
+			push_move(list, move_new(from, to, move_type));
+	} else {
+		push_move(list, move_new(from, to, MOVE_QUIET));
 	}
-	stack->ptr[stack->index] = move;
-	++stack->index;
 }
 
-static int get_number_of_moves(const MoveStack *stack)
+static void add_pawn_capture(MoveList *list, Square from, Square to, Color c)
 {
-	return stack->index;
+	if (is_promotion_square(to, c)) {
+		for (MoveType move_type = MOVE_KNIGHT_PROMOTION_CAPTURE;
+		     move_type <= MOVE_QUEEN_PROMOTION_CAPTURE; ++move_type)
+			push_move(list, move_new(from, to, move_type));
+	} else {
+		push_move(list, move_new(from, to, MOVE_CAPTURE));
+	}
 }
 
 // 2k5/8/5Pp1/8/8/8/8/2K5 w - - 0 1
-static void add_pseudo_legal_pawn_moves(MoveStack *move_stack,
+static void add_pseudo_legal_pawn_moves(MoveList *list,
 					const Position *pos)
 {
 	const Color color = pos_get_side_to_move(pos);
@@ -448,7 +463,7 @@ static void add_pseudo_legal_pawn_moves(MoveStack *move_stack,
 			const Square from = get_index_of_first_bit_and_unset(&attackers);
 			const Square to = sq;
 			const Move move = move_new(from, to, MOVE_EP_CAPTURE);
-			push_move(move_stack, move);
+			push_move(list, move);
 		}
 	}
 
@@ -458,51 +473,33 @@ static void add_pseudo_legal_pawn_moves(MoveStack *move_stack,
 		u64 targets = get_single_push(from, occ, color);
 		if (targets) {
 			const Square to = get_index_of_first_bit(targets);
-			if (to >= A8) {
-				for (MoveType move_type = MOVE_KNIGHT_PROMOTION;
-				move_type <= MOVE_QUEEN_PROMOTION; ++move_type) {
-					const Move move = move_new(from, to, move_type);
-					push_move(move_stack, move);
-				}
-			} else {
-				const Move move = move_new(from, to, MOVE_QUIET);
-				push_move(move_stack, move);
-			}
+			add_pawn_push(list, from, to, color);
 		}
 
 		targets = get_double_push(from, occ, color);
 		if (targets) {
 			const Square to = get_index_of_first_bit(targets);
 			const Move move = move_new(from, to, MOVE_DOUBLE_PAWN_PUSH);
-			push_move(move_stack, move);
+			push_move(list, move);
 		}
 
 		targets = get_pawn_attacks(from, color) & enemy_pieces;
 		while (targets) {
 			const Square to = get_index_of_first_bit_and_unset(&targets);
-			if (to >= A8) {
-				for (MoveType move_type = MOVE_KNIGHT_PROMOTION_CAPTURE;
-				move_type <= MOVE_QUEEN_PROMOTION_CAPTURE;
-				++move_type) {
-					const Move move = move_new(from, to, move_type);
-					push_move(move_stack, move);
-				}
-			} else {
-				const Move move = move_new(from, to, MOVE_CAPTURE);
-				push_move(move_stack, move);
-			}
+			add_pawn_capture(list, from, to, color);
 		}
 	}
 }
 
-static void add_pseudo_legal_king_moves(MoveStack *move_stack,
-					const Position *pos)
+/*
+ * Add the castling moves of the side to move. The king must not be in check
+ * and must not pass through or land on an attacked square, so these moves are
+ * always legal.
+ */
+static void add_castling_moves(MoveList *list, const Position *pos)
 {
 	const Color color = pos_get_side_to_move(pos);
 	const Square from = pos_get_king_square(pos, color);
-	const u64 occ = pos_get_color_bitboard(pos, color) |
-	pos_get_color_bitboard(pos, !color);
-	const u64 friendly_pieces = occ & pos_get_color_bitboard(pos, color);
 
 	if (pos_has_castling_right(pos, color, CASTLING_SIDE_KING)) {
 		if (color == COLOR_BLACK && from != E8) {
@@ -518,7 +515,7 @@ static void add_pseudo_legal_king_moves(MoveStack *move_stack,
 		    !movegen_is_square_attacked(from, !color, pos)) {
 			const Square to   = color == COLOR_WHITE ? G1 : G8;
 			const Move move = move_new(from, to, MOVE_KING_CASTLE);
-			push_move(move_stack, move);
+			push_move(list, move);
 		}
 	}
 	if (pos_has_castling_right(pos, color, CASTLING_SIDE_QUEEN)) {
@@ -537,9 +534,19 @@ static void add_pseudo_legal_king_moves(MoveStack *move_stack,
 		    !movegen_is_square_attacked(from, !color, pos)) {
 			const Square to   = color == COLOR_WHITE ? C1 : C8;
 			const Move move = move_new(from, to, MOVE_QUEEN_CASTLE);
-			push_move(move_stack, move);
+			push_move(list, move);
 		}
 	}
+}
+
+static void add_pseudo_legal_king_moves(MoveList *list,
+					const Position *pos)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const Square from = pos_get_king_square(pos, color);
+	const u64 friendly_pieces = pos_get_color_bitboard(pos, color);
+
+	add_castling_moves(list, pos);
 
 	u64 targets = get_king_attacks(from) & ~friendly_pieces;
 	while (targets) {
@@ -547,12 +554,12 @@ static void add_pseudo_legal_king_moves(MoveStack *move_stack,
 		const Move move = pos_get_piece_at(pos, to) == PIECE_NONE ?
 		                  move_new(from, to, MOVE_QUIET) :
 		                  move_new(from, to, MOVE_CAPTURE);
-		push_move(move_stack, move);
+		push_move(list, move);
 	}
 }
 
 static inline void add_pseudo_legal_moves(
-MoveStack *move_stack, PieceType piece_type, const Position *pos)
+MoveList *list, PieceType piece_type, const Position *pos)
 {
 	const Color color = pos_get_side_to_move(pos);
 	const Piece piece = pos_make_piece(piece_type, color);
@@ -566,7 +573,7 @@ MoveStack *move_stack, PieceType piece_type, const Position *pos)
 		u64 targets = 0;
 		switch (piece_type) {
 		case PIECE_TYPE_PAWN:
-			add_pseudo_legal_pawn_moves(move_stack, pos);
+			add_pseudo_legal_pawn_moves(list, pos);
 			return;
 		case PIECE_TYPE_KNIGHT:
 			targets = get_knight_attacks(from);
@@ -581,7 +588,7 @@ MoveStack *move_stack, PieceType piece_type, const Position *pos)
 			targets = get_queen_attacks(from, occ);
 			break;
 		case PIECE_TYPE_KING:
-			add_pseudo_legal_king_moves(move_stack, pos);
+			add_pseudo_legal_king_moves(list, pos);
 			break;
 		default:
 			abort();
@@ -592,11 +599,284 @@ MoveStack *move_stack, PieceType piece_type, const Position *pos)
 			const Move move = pos_get_piece_at(pos, to) == PIECE_NONE ?
 			                  move_new(from, to, MOVE_QUIET) :
 			                  move_new(from, to, MOVE_CAPTURE);
-			push_move(move_stack, move);
+			push_move(list, move);
 		}
 	}
 }
 
+/*
+ * Return the pieces of both colors that attack the square with the given
+ * occupancy. Only the pieces in occ are returned, and the sliders see through
+ * the squares that aren't in it, so removing pieces from occ reveals the
+ * attackers behind them.
+ */
+u64 movegen_attackers_to(Square sq, u64 occ, const Position *pos)
+{
+	const u64 queens = pos_get_type_bitboard(pos, PIECE_TYPE_QUEEN);
+	const u64 rooks = pos_get_type_bitboard(pos, PIECE_TYPE_ROOK) | queens;
+	const u64 bishops = pos_get_type_bitboard(pos, PIECE_TYPE_BISHOP) | queens;
+	const u64 knights = pos_get_type_bitboard(pos, PIECE_TYPE_KNIGHT);
+	const u64 kings = pos_get_type_bitboard(pos, PIECE_TYPE_KING);
+	const u64 white_pawns = pos_get_piece_bitboard(pos, PIECE_WHITE_PAWN);
+	const u64 black_pawns = pos_get_piece_bitboard(pos, PIECE_BLACK_PAWN);
+
+	const u64 attackers = (get_pawn_attacks(sq, COLOR_WHITE) & black_pawns)
+	                    | (get_pawn_attacks(sq, COLOR_BLACK) & white_pawns)
+	                    | (get_knight_attacks(sq) & knights)
+	                    | (get_rook_attacks(sq, occ) & rooks)
+	                    | (get_bishop_attacks(sq, occ) & bishops)
+	                    | (get_king_attacks(sq) & kings);
+	return attackers & occ;
+}
+
+/*
+ * The information needed to generate only legal moves, computed once per
+ * position. The check mask has the squares where pieces other than the king
+ * may move to: every square when the king is not in check, the checking piece
+ * and the squares between it and the king when there's one checker, and no
+ * square in double check. The pinned pieces can only move along the line
+ * crossing them and their king.
+ *
+ * The generation type and origins restrict which moves are generated, so the
+ * search can generate tactical and quiet moves separately and test a single
+ * move by generating only the moves of the piece it moves. Tactical moves are
+ * the captures and the promotions, and the quiet moves are all the others.
+ */
+enum generation_type {
+	GENERATION_TACTICAL,
+	GENERATION_QUIETS,
+	GENERATION_ALL,
+};
+
+struct legality {
+	Square king_sq;
+	u64 checkers;
+	u64 check_mask;
+	u64 pinned;
+	u64 origins;
+	enum generation_type type;
+};
+
+static void init_legality(struct legality *legality, const Position *pos,
+			  enum generation_type type, u64 origins)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const u64 friendly_pieces = pos_get_color_bitboard(pos, color);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+	const u64 occ = friendly_pieces | enemy_pieces;
+	const Square king_sq = pos_get_king_square(pos, color);
+
+	legality->king_sq = king_sq;
+	legality->type = type;
+	legality->origins = origins;
+	legality->checkers = movegen_attackers_to(king_sq, occ, pos) & enemy_pieces;
+	switch (count_bits(legality->checkers)) {
+	case 0:
+		legality->check_mask = ~U64(0x0);
+		break;
+	case 1:
+		legality->check_mask = legality->checkers |
+		                       between_bitboards[king_sq][get_index_of_first_bit(legality->checkers)];
+		break;
+	default:
+		legality->check_mask = 0;
+		break;
+	}
+
+	const u64 queens = pos_get_type_bitboard(pos, PIECE_TYPE_QUEEN);
+	const u64 rooks = pos_get_type_bitboard(pos, PIECE_TYPE_ROOK) | queens;
+	const u64 bishops = pos_get_type_bitboard(pos, PIECE_TYPE_BISHOP) | queens;
+	u64 snipers = ((get_rook_attacks(king_sq, 0) & rooks) |
+	               (get_bishop_attacks(king_sq, 0) & bishops)) & enemy_pieces;
+	legality->pinned = 0;
+	while (snipers) {
+		const Square sq = get_index_of_first_bit_and_unset(&snipers);
+		const u64 blockers = between_bitboards[king_sq][sq] & occ;
+		if (count_bits(blockers) == 1)
+			legality->pinned |= blockers & friendly_pieces;
+	}
+}
+
+/*
+ * Return the squares a piece at sq may move to without leaving the king in
+ * check, not considering the squares it actually attacks.
+ */
+static u64 get_legal_mask(Square sq, const struct legality *legality)
+{
+	if (legality->pinned & U64(0x1) << sq)
+		return legality->check_mask & line_bitboards[legality->king_sq][sq];
+	return legality->check_mask;
+}
+
+/*
+ * Return the squares the moves being generated may go to, according to the
+ * generation type.
+ */
+static u64 get_target_mask(const Position *pos, const struct legality *legality)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const u64 friendly_pieces = pos_get_color_bitboard(pos, color);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+
+	switch (legality->type) {
+	case GENERATION_TACTICAL:
+		return enemy_pieces;
+	case GENERATION_QUIETS:
+		return ~(friendly_pieces | enemy_pieces);
+	default:
+		return ~friendly_pieces;
+	}
+}
+
+static void add_moves_to_targets(MoveList *list, Square from, u64 targets,
+				 u64 enemy_pieces)
+{
+	while (targets) {
+		const Square to = get_index_of_first_bit_and_unset(&targets);
+		const Move move = enemy_pieces & U64(0x1) << to ?
+		                  move_new(from, to, MOVE_CAPTURE) :
+		                  move_new(from, to, MOVE_QUIET);
+		push_move(list, move);
+	}
+}
+
+/*
+ * En passant is the only move where two pieces leave the same rank, so it can
+ * expose the king to a slider even when neither pawn is pinned. Because of
+ * that it is checked by removing both pawns from the occupancy and looking for
+ * attacks on the king.
+ */
+static void add_legal_ep_captures(MoveList *list, const Position *pos,
+				  const struct legality *legality)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+	const u64 occ = enemy_pieces | pos_get_color_bitboard(pos, color);
+	const Square to = pos_get_enpassant(pos);
+	const Square captured_sq = color == COLOR_WHITE ? to - 8 : to + 8;
+	const Piece pawn = pos_make_piece(PIECE_TYPE_PAWN, color);
+
+	u64 attackers = get_pawn_attacks(to, !color) &
+	                pos_get_piece_bitboard(pos, pawn) & legality->origins;
+	while (attackers) {
+		const Square from = get_index_of_first_bit_and_unset(&attackers);
+		const u64 new_occ = (occ ^ U64(0x1) << from ^ U64(0x1) << captured_sq) |
+		                    U64(0x1) << to;
+		if (movegen_attackers_to(legality->king_sq, new_occ, pos) & enemy_pieces)
+			continue;
+		push_move(list, move_new(from, to, MOVE_EP_CAPTURE));
+	}
+}
+
+static void add_legal_pawn_moves(MoveList *list, const Position *pos,
+				 const struct legality *legality)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const Piece piece = pos_make_piece(PIECE_TYPE_PAWN, color);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+	const u64 occ = enemy_pieces | pos_get_color_bitboard(pos, color);
+
+	const bool captures = legality->type != GENERATION_QUIETS;
+	const bool quiets = legality->type != GENERATION_TACTICAL;
+	const u64 promotion_rank = color == COLOR_WHITE ? rank_bitboards[RANK_8] :
+	                                                  rank_bitboards[RANK_1];
+	u64 push_mask = ~U64(0x0);
+	if (legality->type == GENERATION_TACTICAL)
+		push_mask = promotion_rank;
+	else if (legality->type == GENERATION_QUIETS)
+		push_mask = ~promotion_rank;
+
+	if (captures && pos_enpassant_possible(pos))
+		add_legal_ep_captures(list, pos, legality);
+
+	u64 bb = pos_get_piece_bitboard(pos, piece) & legality->origins;
+	while (bb) {
+		const Square from = get_index_of_first_bit_and_unset(&bb);
+		const u64 mask = get_legal_mask(from, legality);
+
+		u64 targets = get_single_push(from, occ, color) & mask & push_mask;
+		if (targets)
+			add_pawn_push(list, from, get_index_of_first_bit(targets), color);
+
+		targets = quiets ? get_double_push(from, occ, color) & mask : 0;
+		if (targets) {
+			const Square to = get_index_of_first_bit(targets);
+			push_move(list, move_new(from, to, MOVE_DOUBLE_PAWN_PUSH));
+		}
+
+		targets = captures ? get_pawn_attacks(from, color) & enemy_pieces & mask : 0;
+		while (targets) {
+			const Square to = get_index_of_first_bit_and_unset(&targets);
+			add_pawn_capture(list, from, to, color);
+		}
+	}
+}
+
+/*
+ * The king can't use the check mask, instead each target square is tested for
+ * attacks with the king removed from the board, otherwise the king would block
+ * the attack of a slider on the squares behind it.
+ */
+static void add_legal_king_moves(MoveList *list, const Position *pos,
+				 const struct legality *legality)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const Square from = legality->king_sq;
+	const u64 friendly_pieces = pos_get_color_bitboard(pos, color);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+	const u64 occ = (friendly_pieces | enemy_pieces) ^ U64(0x1) << from;
+
+	if (!(legality->origins & U64(0x1) << from))
+		return;
+	if (!legality->checkers && legality->type != GENERATION_TACTICAL)
+		add_castling_moves(list, pos);
+
+	u64 targets = get_king_attacks(from) & get_target_mask(pos, legality);
+	u64 legal_targets = 0;
+	while (targets) {
+		const Square to = get_index_of_first_bit_and_unset(&targets);
+		if (!(movegen_attackers_to(to, occ, pos) & enemy_pieces))
+			legal_targets |= U64(0x1) << to;
+	}
+	add_moves_to_targets(list, from, legal_targets, enemy_pieces);
+}
+
+static void add_legal_moves(MoveList *list, PieceType piece_type,
+			    const Position *pos, const struct legality *legality)
+{
+	const Color color = pos_get_side_to_move(pos);
+	const Piece piece = pos_make_piece(piece_type, color);
+	const u64 friendly_pieces = pos_get_color_bitboard(pos, color);
+	const u64 enemy_pieces = pos_get_color_bitboard(pos, !color);
+	const u64 occ = friendly_pieces | enemy_pieces;
+
+	const u64 target_mask = get_target_mask(pos, legality);
+
+	u64 bb = pos_get_piece_bitboard(pos, piece) & legality->origins;
+	while (bb) {
+		const Square from = get_index_of_first_bit_and_unset(&bb);
+		u64 targets = 0;
+		switch (piece_type) {
+		case PIECE_TYPE_KNIGHT:
+			targets = get_knight_attacks(from);
+			break;
+		case PIECE_TYPE_ROOK:
+			targets = get_rook_attacks(from, occ);
+			break;
+		case PIECE_TYPE_BISHOP:
+			targets = get_bishop_attacks(from, occ);
+			break;
+		case PIECE_TYPE_QUEEN:
+			targets = get_queen_attacks(from, occ);
+			break;
+		default:
+			abort();
+		}
+		targets &= target_mask & get_legal_mask(from, legality);
+		add_moves_to_targets(list, from, targets, enemy_pieces);
+	}
+}
+
 static int get_number_of_pseudo_legal_moves(PieceType piece_type, Color c,
 					    const Position *pos)
 {
@@ -650,6 +930,7 @@ void movegen_init(void)
 	init_magics();
 	init_knight_attacks();
 	init_king_attacks();
+	init_lines();
 }
 
 /*
@@ -704,52 +985,95 @@ int movegen_get_number_of_pseudo_legal_moves(const Position *pos, Color c)
 	     + get_number_of_pseudo_legal_moves(PIECE_TYPE_KING, c, pos);
 }
 
-Move *movegen_get_pseudo_legal_moves(const Position *pos, size_t *len)
+/*
+ * Fill the list with the pseudo-legal moves of the side to move. The list is
+ * owned by the caller, usually allocated on the stack, so no memory is
+ * allocated during move generation.
+ */
+void movegen_get_pseudo_legal_moves(const Position *pos, MoveList *list)
+{
+	list->len = 0;
+	add_pseudo_legal_moves(list, PIECE_TYPE_PAWN, pos);
+	add_pseudo_legal_moves(list, PIECE_TYPE_KNIGHT, pos);
+	add_pseudo_legal_moves(list, PIECE_TYPE_ROOK, pos);
+	add_pseudo_legal_moves(list, PIECE_TYPE_BISHOP, pos);
+	add_pseudo_legal_moves(list, PIECE_TYPE_QUEEN, pos);
+	add_pseudo_legal_moves(list, PIECE_TYPE_KING, pos);
+}
+
+static void add_all_legal_moves(MoveList *list, const Position *pos,
+				const struct legality *legality)
+{
+	list->len = 0;
+	if (count_bits(legality->checkers) < 2) {
+		add_legal_pawn_moves(list, pos, legality);
+		add_legal_moves(list, PIECE_TYPE_KNIGHT, pos, legality);
+		add_legal_moves(list, PIECE_TYPE_ROOK, pos, legality);
+		add_legal_moves(list, PIECE_TYPE_BISHOP, pos, legality);
+		add_legal_moves(list, PIECE_TYPE_QUEEN, pos, legality);
+	}
+	add_legal_king_moves(list, pos, legality);
+}
+
+/*
+ * Fill the list with the legal moves of the side to move. Checkers and pinned
+ * pieces are found once for the position, so unlike the pseudo-legal moves
+ * there's no need to make each move to test whether it leaves the king in
+ * check. In double check only the king can move.
+ */
+void movegen_get_legal_moves(const Position *pos, MoveList *list)
 {
-	MoveStack move_stack;
+	struct legality legality;
+	init_legality(&legality, pos, GENERATION_ALL, ~U64(0x0));
+	add_all_legal_moves(list, pos, &legality);
+}
 
-	init_move_stack(&move_stack);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_PAWN, pos);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_KNIGHT, pos);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_ROOK, pos);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_BISHOP, pos);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_QUEEN, pos);
-	add_pseudo_legal_moves(&move_stack, PIECE_TYPE_KING, pos);
+/*
+ * Fill the list with the legal tactical moves, the captures, including en
+ * passant, and the promotions. Except for the pawn pushes to the last rank the
+ * targets are limited to the squares of the enemy pieces, so no quiet move is
+ * generated only to be thrown away.
+ */
+void movegen_get_legal_tactical_moves(const Position *pos, MoveList *list)
+{
+	struct legality legality;
+	init_legality(&legality, pos, GENERATION_TACTICAL, ~U64(0x0));
+	add_all_legal_moves(list, pos, &legality);
+}
 
-	*len = get_number_of_moves(&move_stack);
-	return move_stack.ptr;
+/*
+ * Fill the list with the legal moves that are not tactical, the moves that are
+ * neither captures nor promotions.
+ */
+void movegen_get_legal_quiet_moves(const Position *pos, MoveList *list)
+{
+	struct legality legality;
+	init_legality(&legality, pos, GENERATION_QUIETS, ~U64(0x0));
+	add_all_legal_moves(list, pos, &legality);
 }
 
 /*
- * Return the number of possible moves on an empty board containing only the
- * moving piece. The color of the piece is only used for pawns so for any other
- * piece the result will be the same for either white or black.
+ * Return true if the move is legal in the position. It is used for moves that
+ * come from somewhere else, like the transposition table, and could belong to
+ * another position, so only the moves of the piece at the origin square are
+ * generated to look for it.
  */
-int movegen_get_number_of_possible_moves(Piece piece, Square sq) {
-	const PieceType pt = pos_get_piece_type(piece);
-	const Color c = pos_get_piece_color(piece);
-	u64 targets = 0;
-	switch (pt) {
-	case PIECE_TYPE_PAWN:
-		targets = get_single_push(sq, 0, c) | get_double_push(sq, 0, c);
-		break;
-	case PIECE_TYPE_KNIGHT:
-		targets = get_knight_attacks(sq);
-		break;
-	case PIECE_TYPE_ROOK:
-		targets = get_rook_attacks(sq, 0);
-		break;
-	case PIECE_TYPE_BISHOP:
-		targets = get_bishop_attacks(sq, 0);
-		break;
-	case PIECE_TYPE_QUEEN:
-		targets = get_queen_attacks(sq, 0);
-		break;
-	case PIECE_TYPE_KING:
-		targets = get_king_attacks(sq);
-		break;
-	default:
-		abort();
+bool movegen_is_move_legal(const Position *pos, Move move)
+{
+	const Square from = move_get_origin(move);
+	const Color color = pos_get_side_to_move(pos);
+	const u64 origin = U64(0x1) << from;
+
+	if (!move || !(pos_get_color_bitboard(pos, color) & origin))
+		return false;
+
+	struct legality legality;
+	MoveList list;
+	init_legality(&legality, pos, GENERATION_ALL, origin);
+	add_all_legal_moves(&list, pos, &legality);
+	for (size_t i = 0; i < list.len; ++i) {
+		if (list.moves[i] == move)
+			return true;
 	}
-	return count_bits(targets);
+	return false;
 }
@@ -1,10 +1,31 @@
 #ifndef MOVEGEN_H
 #define MOVEGEN_H
 
-int movegen_get_number_of_possible_moves(Piece piece, Square sq);
+/*
+ * The chess positions with the most number of legal moves for a side that I
+ * know of are
+ * "R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1" and
+ * "3Q4/1Q4Q1/4Q3/2Q4R/Q4Q2/3Q4/1Q4Rp/1K1BBNNk w - - 0 1"
+ * with 218 legal moves for white, so the maximum number of legal or illegal
+ * moves for any position must be around that value. Therefore a move list has
+ * capacity for 256 moves, which is the closest power of 2, and it never has to
+ * grow.
+ */
+#define MAX_MOVES 256
+
+typedef struct move_list {
+	Move moves[MAX_MOVES];
+	size_t len;
+} MoveList;
+
 bool movegen_is_square_attacked(Square sq, Color by_side, const Position *pos);
+u64 movegen_attackers_to(Square sq, u64 occ, const Position *pos);
 int movegen_get_number_of_pseudo_legal_moves(const Position *pos, Color c);
-Move *movegen_get_pseudo_legal_moves(const Position *pos, size_t *len);
+void movegen_get_pseudo_legal_moves(const Position *pos, MoveList *list);
+void movegen_get_legal_moves(const Position *pos, MoveList *list);
+void movegen_get_legal_tactical_moves(const Position *pos, MoveList *list);
+void movegen_get_legal_quiet_moves(const Position *pos, MoveList *list);
+bool movegen_is_move_legal(const Position *pos, Move move);
 void movegen_init(void);
 
 #endif
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "bit.h"
+#include "pos.h"
+#include "move.h"
+#include "movegen.h"
+#include "perft.h"
+
+/*
+ * Perft counts the leaf nodes of the move generation tree up to a certain
+ * depth, the results can be compared to known numbers to find bugs in the move
+ * generator, and the time it takes measures the speed of move generation and
+ * of doing and undoing moves.
+ *
+ * Since only legal moves are generated, the number of leaf nodes below a node
+ * at depth 1 is just the number of moves generated, so the last ply is counted
+ * in bulk instead of doing and undoing each move.
+ *
+ * Transpositions are very common in the tree, so the counts of subtrees are
+ * stored in a hash table indexed by the Zobrist key of the position and the
+ * depth. The table is shared by all threads without locks, each entry stores
+ * the key XORed with the data so a torn entry written by two threads at the
+ * same time is just a miss.
+ */
+
+#define PERFT_TABLE_SIZE (1 << 20)
+
+struct perft_entry {
+	_Atomic u64 check;
+	_Atomic u64 data;
+};
+
+struct perft_worker {
+	const Position *root;
+	const MoveList *root_moves;
+	u64 *root_nodes;
+	atomic_size_t *next_move;
+	struct perft_entry *table;
+	int depth;
+};
+
+static const PerftTest suite[] = {
+	{"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6, 119060324},
+	{"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 5, 193690690},
+	{"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 7, 178633661},
+	{"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292},
+	{"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 5, 15833292},
+	{"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 5, 89941194},
+	{"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 5, 164075551},
+};
+
+/*
+ * The depth is stored in the 8 least significant bits of the data and the
+ * number of nodes in the rest.
+ */
+static bool probe(const struct perft_entry *table, u64 key, int depth, u64 *nodes)
+{
+	const struct perft_entry *entry = &table[key & (PERFT_TABLE_SIZE - 1)];
+	const u64 data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+	const u64 check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+
+	if ((check ^ data) != key || (int)(data & 0xff) != depth)
+		return false;
+	*nodes = data >> 8;
+	return true;
+}
+
+static void store(struct perft_entry *table, u64 key, int depth, u64 nodes)
+{
+	struct perft_entry *entry = &table[key & (PERFT_TABLE_SIZE - 1)];
+	const u64 data = nodes << 8 | (u64)depth;
+
+	atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+	atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+static u64 count(Position *pos, int depth, struct perft_entry *table)
+{
+	if (depth == 0)
+		return 1;
+
+	MoveList list;
+	movegen_get_legal_moves(pos, &list);
+	if (depth == 1)
+		return list.len;
+
+	const u64 key = pos_get_key(pos);
+	u64 nodes = 0;
+	if (probe(table, key, depth, &nodes))
+		return nodes;
+
+	for (size_t i = 0; i < list.len; ++i) {
+		move_do(pos, list.moves[i]);
+		nodes += count(pos, depth - 1, table);
+		move_undo(pos, list.moves[i]);
+	}
+	store(table, key, depth, nodes);
+	return nodes;
+}
+
+/*
+ * Each worker takes the next root move that hasn't been taken by any worker
+ * yet, until there are no root moves left.
+ */
+static void *work(void *arg)
+{
+	struct perft_worker *worker = arg;
+	Position *pos = pos_copy(worker->root);
+
+	for (;;) {
+		const size_t i = atomic_fetch_add(worker->next_move, 1);
+		if (i >= worker->root_moves->len)
+			break;
+		const Move move = worker->root_moves->moves[i];
+		move_do(pos, move);
+		worker->root_nodes[i] = count(pos, worker->depth - 1, worker->table);
+		move_undo(pos, move);
+	}
+
+	pos_destroy(pos);
+	return NULL;
+}
+
+/*
+ * Return the number of leaf nodes at depth from the position. The root moves
+ * are split among num_threads threads. The root moves and the number of leaf
+ * nodes below each of them are stored in root_moves and root_nodes, which must
+ * have room for MAX_MOVES numbers, so they can be divided.
+ */
+u64 perft(const Position *pos, int depth, int num_threads, MoveList *root_moves, u64 *root_nodes)
+{
+	movegen_get_legal_moves(pos, root_moves);
+	if (depth <= 0) {
+		root_moves->len = 0;
+		return 1;
+	}
+
+	struct perft_entry *table = calloc(PERFT_TABLE_SIZE, sizeof(*table));
+	pthread_t *threads = malloc(num_threads * sizeof(*threads));
+	if (!table || !threads) {
+		fprintf(stderr, "Could not allocate memory.\n");
+		exit(1);
+	}
+
+	atomic_size_t next_move = 0;
+	struct perft_worker worker = {
+		.root = pos,
+		.root_moves = root_moves,
+		.root_nodes = root_nodes,
+		.next_move = &next_move,
+		.table = table,
+		.depth = depth,
+	};
+	int num_started = 0;
+	for (int i = 1; i < num_threads; ++i) {
+		if (pthread_create(&threads[num_started], NULL, work, &worker))
+			break;
+		++num_started;
+	}
+	work(&worker);
+	for (int i = 0; i < num_started; ++i)
+		pthread_join(threads[i], NULL);
+
+	u64 nodes = 0;
+	for (size_t i = 0; i < root_moves->len; ++i)
+		nodes += root_nodes[i];
+
+	free(threads);
+	free(table);
+	return nodes;
+}
+
+/*
+ * Return the standard positions used to test move generators, with the
+ * number of leaf nodes at a certain depth.
+ */
+const PerftTest *perft_get_suite(size_t *len)
+{
+	*len = sizeof(suite) / sizeof(suite[0]);
+	return suite;
+}
@@ -0,0 +1,13 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+typedef struct perft_test {
+	const char *fen;
+	int depth;
+	u64 nodes;
+} PerftTest;
+
+u64 perft(const Position *pos, int depth, int num_threads, MoveList *root_moves, u64 *root_nodes);
+const PerftTest *perft_get_suite(size_t *len);
+
+#endif
@@ -1,6 +1,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 
 #include "bit.h"
 #include "pos.h"
+#include "rng.h"
 
 /*
  * The piece placement is stored in two formats, in piece-centric bitboard
@@ -57,16 +59,50 @@
  * that it happened later on), all this irreversibe state is stored in a stack
  * where the top is the current state and to undo a move one only has to pop
  * the last irreversible state off the stack and undo the changes to the
- * reversibe data.
+ * reversibe data. The stack is a fixed array inside the position, so doing and
+ * undoing moves never allocates memory, and it's big enough to hold the
+ * longest game we expect to receive plus the deepest line the search can
+ * reach from it.
+ *
+ * The Zobrist key of the position is also kept in the irreversible state. It
+ * is updated incrementally by the functions that modify the position, and
+ * since the key of the previous position is stored in the previous
+ * irreversible state, undoing a move doesn't need to update it at all.
+ */
+
+/*
+ * The set of random numbers in the Zobrist array map to each possible variation
+ * in the state of the position. 12 * 64 random numbers for each piece on each
+ * square, 4 castling rights, 8 possible en passant files and finally 1
+ * possible variation of color when it is black instead of white.
  */
+#define NUM_PIECES 12
+#define NUM_SQUARES 64
+#define NUM_CASTLING_RIGHTS 4
+#define NUM_EN_PASSANT_FILES 8
+#define NUM_COLOR_VARIATION 1
+#define ZOBRIST_ARRAY_SIZE (NUM_PIECES * NUM_SQUARES + NUM_CASTLING_RIGHTS +\
+                            NUM_EN_PASSANT_FILES + NUM_COLOR_VARIATION)
+#define ZOBRIST_CASTLING_OFFSET (NUM_PIECES * NUM_SQUARES)
+#define ZOBRIST_EN_PASSANT_OFFSET (ZOBRIST_CASTLING_OFFSET + NUM_CASTLING_RIGHTS)
+#define ZOBRIST_COLOR_OFFSET (ZOBRIST_EN_PASSANT_OFFSET + NUM_EN_PASSANT_FILES)
+
+#define MAX_GAME_LENGTH 2048
+#define MAX_SEARCH_PLY 256
+#define MAX_IRREVERSIBLE_STATES (MAX_GAME_LENGTH + MAX_SEARCH_PLY)
 
 struct irreversible_state {
+	u64 key;
 	u8 castling_rights_and_enpassant;
 	u8 halfmove_clock;
 	u8 captured_piece;
-	struct irreversible_state *previous;
 };
 
+/*
+ * The irreversible pointer always points to the top of the stack of
+ * irreversible states. The stack is the last member so copying a position only
+ * has to copy the states that are in use.
+ */
 struct position {
 	struct irreversible_state *irreversible;
 	u8 side_to_move;
@@ -74,8 +110,31 @@ struct position {
 	u64 color_bb[2];
 	u64 type_bb[6];
 	Piece board[64];
+	struct irreversible_state irreversible_states[MAX_IRREVERSIBLE_STATES];
 };
 
+static u64 zobrist_numbers[ZOBRIST_ARRAY_SIZE];
+
+static u64 get_piece_key(Piece piece, Square sq)
+{
+	return zobrist_numbers[NUM_SQUARES * piece + sq];
+}
+
+static u64 get_castling_key(Color c, CastlingSide side)
+{
+	return zobrist_numbers[ZOBRIST_CASTLING_OFFSET + 2 * c + side];
+}
+
+static u64 get_enpassant_key(File file)
+{
+	return zobrist_numbers[ZOBRIST_EN_PASSANT_OFFSET + file];
+}
+
+static u64 get_color_key(void)
+{
+	return zobrist_numbers[ZOBRIST_COLOR_OFFSET];
+}
+
 /*
  * Check if ch is one of the characters in str, where str is a string containing
  * all characters to be checked and not separated by space.
@@ -146,6 +205,7 @@ static size_t parse_side(Position *pos, const char *str)
 		break;
 	case 'b':
 		pos->side_to_move = COLOR_BLACK;
+		pos->irreversible->key ^= get_color_key();
 		break;
 	default:
 		return 0;
@@ -350,12 +410,16 @@ void pos_increment_fullmove_counter(Position *pos)
 
 void pos_remove_castling(Position *pos, Color c, CastlingSide side)
 {
+	if (pos_has_castling_right(pos, c, side))
+		pos->irreversible->key ^= get_castling_key(c, side);
 	pos->irreversible->castling_rights_and_enpassant &= ~(1 << side <<
 	                                                      2 * c);
 }
 
 void pos_add_castling(Position *pos, Color c, CastlingSide side)
 {
+	if (!pos_has_castling_right(pos, c, side))
+		pos->irreversible->key ^= get_castling_key(c, side);
 	pos->irreversible->castling_rights_and_enpassant |= 1 << side <<
 	                                                    2 * c;
 }
@@ -366,6 +430,7 @@ void pos_flip_side_to_move(Position *pos)
 		pos->side_to_move = COLOR_BLACK;
 	else
 		pos->side_to_move = COLOR_WHITE;
+	pos->irreversible->key ^= get_color_key();
 }
 
 void pos_set_captured_piece(Position *pos, Piece piece)
@@ -383,6 +448,7 @@ void pos_remove_piece(Position *pos, Square sq)
 	pos->color_bb[pos_get_piece_color(piece)] &= ~bb;
 	pos->type_bb[pos_get_piece_type(piece)]  &= ~bb;
 	pos->board[sq] = PIECE_NONE;
+	pos->irreversible->key ^= get_piece_key(piece, sq);
 }
 
 /*
@@ -406,6 +472,7 @@ void pos_place_piece(Position *pos, Square sq, Piece piece)
 	pos->color_bb[pos_get_piece_color(piece)] |= bb;
 	pos->type_bb[pos_get_piece_type(piece)]  |= bb;
 	pos->board[sq] = piece;
+	pos->irreversible->key ^= get_piece_key(piece, sq);
 }
 
 void pos_reset_halfmove_clock(Position *pos)
@@ -420,6 +487,10 @@ void pos_increment_halfmove_clock(Position *pos)
 
 void pos_unset_enpassant(Position *pos)
 {
+	if (pos_enpassant_possible(pos)) {
+		const Square sq = pos_get_enpassant(pos);
+		pos->irreversible->key ^= get_enpassant_key(pos_get_file_of_square(sq));
+	}
 	pos->irreversible->castling_rights_and_enpassant &= 0xf;
 }
 
@@ -428,6 +499,8 @@ void pos_unset_enpassant(Position *pos)
  */
 void pos_set_enpassant(Position *pos, File file)
 {
+	pos_unset_enpassant(pos);
+	pos->irreversible->key ^= get_enpassant_key(file & 0x7);
 	pos->irreversible->castling_rights_and_enpassant &= 0x8f;
 	pos->irreversible->castling_rights_and_enpassant |= 0x80;
 	pos->irreversible->castling_rights_and_enpassant |= (file & 0x7) << 4;
@@ -467,6 +540,11 @@ Square pos_get_enpassant(const Position *pos)
 	return pos_file_rank_to_square(f, r);
 }
 
+u64 pos_get_key(const Position *pos)
+{
+	return pos->irreversible->key;
+}
+
 Color pos_get_side_to_move(const Position *pos)
 {
 	return pos->side_to_move;
@@ -506,6 +584,14 @@ u64 pos_get_piece_bitboard(const Position *pos, Piece piece)
 	return bb;
 }
 
+/*
+ * Return the pieces of the type of both colors.
+ */
+u64 pos_get_type_bitboard(const Position *pos, PieceType pt)
+{
+	return pos->type_bb[pt];
+}
+
 u64 pos_get_color_bitboard(const Position *pos, Color c)
 {
 	return pos->color_bb[c];
@@ -513,9 +599,7 @@ u64 pos_get_color_bitboard(const Position *pos, Color c)
 
 void pos_backtrack_irreversible_state(Position *pos)
 {
-	struct irreversible_state *const current = pos->irreversible;
-	pos->irreversible = pos->irreversible->previous;
-	free(current);
+	--pos->irreversible;
 }
 
 /*
@@ -529,42 +613,25 @@ void pos_backtrack_irreversible_state(Position *pos)
 void pos_start_new_irreversible_state(Position *pos)
 {
 	struct irreversible_state *current = pos->irreversible;
-	struct irreversible_state *new = malloc(sizeof(*new));
-	if (!new) {
-		fprintf(stderr, "Could not allocate memory.\n");
+	if (current == pos->irreversible_states + MAX_IRREVERSIBLE_STATES - 1) {
+		fprintf(stderr, "Too many moves in the game.\n");
 		exit(1);
 	}
-	memcpy(new, current, sizeof(struct irreversible_state));
-	new->previous = current;
-	pos->irreversible = new;
+	current[1] = current[0];
+	pos->irreversible = current + 1;
 }
 
 Position *pos_copy(const Position *pos)
 {
 	Position *copy = malloc(sizeof(Position));
-	if (!pos) {
+	if (!copy) {
 		fprintf(stderr, "Could not allocate memory.\n");
 		exit(1);
 	}
-	memcpy(copy, pos, sizeof(Position));
-
-	copy->irreversible = malloc(sizeof(struct irreversible_state));
-	if (!pos->irreversible) {
-		fprintf(stderr, "Could not allocate memory.\n");
-		exit(1);
-	}
-	struct irreversible_state *ptr = copy->irreversible;
-	for (struct irreversible_state *is = pos->irreversible; is; is = is->previous) {
-		memcpy(ptr, is, sizeof(struct irreversible_state));
-		if (is->previous) {
-			ptr->previous = malloc(sizeof(struct irreversible_state));
-			if (!ptr->previous) {
-				fprintf(stderr, "Could not allocate memory.\n");
-				exit(1);
-			}
-			ptr = ptr->previous;
-		}
-	}
+	const size_t num_states = pos->irreversible - pos->irreversible_states + 1;
+	memcpy(copy, pos, offsetof(Position, irreversible_states) +
+	                  num_states * sizeof(struct irreversible_state));
+	copy->irreversible = copy->irreversible_states + num_states - 1;
 	return copy;
 }
 
@@ -586,21 +653,14 @@ Position *pos_create(const char *fen)
 		fprintf(stderr, "Could not allocate memory.\n");
 		exit(1);
 	}
-	pos->irreversible = malloc(sizeof(struct irreversible_state));
-	if (!pos->irreversible) {
-		fprintf(stderr, "Could not allocate memory.\n");
-		exit(1);
-	}
+	pos->irreversible = pos->irreversible_states;
 
 	pos->fullmove_counter = 0;
-	pos->irreversible->previous = NULL;
+	pos->side_to_move = COLOR_WHITE;
 	pos->irreversible->captured_piece = PIECE_NONE;
+	pos->irreversible->castling_rights_and_enpassant = 0;
+	pos->irreversible->key = 0;
 	pos_reset_halfmove_clock(pos);
-	pos_unset_enpassant(pos);
-	pos_remove_castling(pos, COLOR_WHITE, CASTLING_SIDE_KING);
-	pos_remove_castling(pos, COLOR_WHITE, CASTLING_SIDE_QUEEN);
-	pos_remove_castling(pos, COLOR_BLACK, CASTLING_SIDE_KING);
-	pos_remove_castling(pos, COLOR_BLACK, CASTLING_SIDE_QUEEN);
 	for (Square sq = A1; sq <= H8; ++sq)
 		pos->board[sq] = PIECE_NONE;
 	for (size_t i = 0; i < 6; ++i)
@@ -618,12 +678,6 @@ Position *pos_create(const char *fen)
 
 void pos_destroy(Position *pos)
 {
-	struct irreversible_state *prev = NULL;
-
-	for (struct irreversible_state *p = pos->irreversible; p; p = prev) {
-		prev = p->previous;
-		free(p);
-	}
 	free(pos);
 }
 
@@ -656,3 +710,18 @@ Piece pos_make_piece(PieceType pt, Color c)
 {
 	return pt << 1 | c;
 }
+
+/*
+ * Generate a set of unique random numbers for Zobrist hashing. It must be
+ * called before any position is created.
+ */
+void pos_init(void)
+{
+	for (size_t i = 0; i < ZOBRIST_ARRAY_SIZE; ++i) {
+		zobrist_numbers[i] = rng_next();
+		for (size_t j = 0; j < i; ++j) {
+			if (zobrist_numbers[i] == zobrist_numbers[j])
+				--i;
+		}
+	}
+}
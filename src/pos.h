@@ -95,12 +95,14 @@ int pos_get_fullmove_counter(const Position *pos);
 int pos_get_halfmove_clock(const Position *pos);
 int pos_enpassant_possible(const Position *pos);
 Square pos_get_enpassant(const Position *pos);
+u64 pos_get_key(const Position *pos);
 Color pos_get_side_to_move(const Position *pos);
 Square pos_get_king_square(const Position *pos, Color c);
 Piece pos_get_piece_at(const Position *pos, Square sq);
 int pos_get_number_of_pieces(const Position *pos, Piece piece);
 int pos_get_number_of_pieces_of_color(const Position *pos, Color c);
 u64 pos_get_piece_bitboard(const Position *pos, Piece piece);
+u64 pos_get_type_bitboard(const Position *pos, PieceType pt);
 u64 pos_get_color_bitboard(const Position *pos, Color c);
 void pos_backtrack_irreversible_state(Position *pos);
 void pos_start_new_irreversible_state(Position *pos);
@@ -113,5 +115,6 @@ Rank pos_get_rank_of_square(Square sq);
 Color pos_get_piece_color(Piece piece);
 PieceType pos_get_piece_type(Piece piece);
 Piece pos_make_piece(PieceType pt, Color c);
+void pos_init(void);
 
 #endif
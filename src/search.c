@@ -1,8 +1,13 @@
 #include <stdlib.h>
 #include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <check.h>
 
@@ -13,103 +18,677 @@
 #include "tt.h"
 #include "eval.h"
 #include "rng.h"
+#include "clock.h"
+#include "search.h"
 
 static const int INFINITE = SHRT_MAX;
 
 #define MAX_DEPTH 128
+/*
+ * The quiescence search goes beyond the maximum depth, but it runs out of
+ * captures and promotions long before doubling it.
+ */
+#define MAX_PLY (2 * MAX_DEPTH)
+
+/*
+ * A side that is checkmated at a ply scores -INFINITE plus the ply, so shorter
+ * mates score better. Any score beyond MATE_BOUND is a mate.
+ */
+#define MATE_BOUND (INFINITE - MAX_PLY)
 #define MAX_KILLER_MOVES 2
+#define MAX_THREADS 256
+#define MAX_MULTI_PV 64
+
+/*
+ * Statistics of the search of a thread, to find out where the time goes. The
+ * quiescence nodes are the part of the nodes searched by the quiescence search
+ * and the selective depth is the highest ply reached.
+ */
+typedef struct search_stats {
+	_Atomic u64 qnodes;
+	u64 tt_probes;
+	u64 tt_hits;
+	u64 cutoffs;
+	u64 first_move_cutoffs;
+	int seldepth;
+} SearchStats;
+
+/*
+ * A frame of the search stack holds what a node at a ply from the root shares
+ * with the nodes before and after it: the move that led to it, 0 for a null
+ * move, its static evaluation, its killer moves and its principal variation,
+ * which is its best move followed by the principal variation of the node
+ * after it. The killer moves of a ply are shared by all the nodes at that ply,
+ * but they are forgotten when a node two plies up starts searching, so they
+ * come from sibling or cousin nodes only.
+ */
+typedef struct search_stack {
+	int ply;
+	Move move;
+	int static_eval;
+	Move killers[MAX_KILLER_MOVES];
+	int pv_len;
+	Move pv[MAX_PLY + 1];
+} SearchStack;
+
+/*
+ * A legal move of the root with its score in the current and the previous
+ * iterations, -INFINITE if it didn't score above alpha, and the number of
+ * nodes of its subtree in the current iteration.
+ */
+typedef struct root_move {
+	Move move;
+	int score;
+	int previous_score;
+	u64 nodes;
+} RootMove;
+
+/*
+ * A line searched from the root: its principal variation, which starts with
+ * the root move, and its score.
+ */
+typedef struct root_line {
+	int score;
+	int pv_len;
+	Move pv[MAX_PLY + 1];
+} RootLine;
+
+/*
+ * The search uses Lazy SMP: every thread runs its own iterative deepening on
+ * its own copy of the position and they only cooperate through the shared
+ * transposition table, where a thread finds the results of the others. The
+ * helper threads start at different depths so they don't all search the same
+ * tree at the same time, and they keep deepening until the main thread, whose
+ * best move is the one played, finishes its search.
+ *
+ * Everything a thread changes during the search, apart from the transposition
+ * table, belongs to the thread. Its search stack has a frame for every ply up
+ * to MAX_PLY and one more, so a node can always prepare the frame of its
+ * grandchildren.
+ *
+ * The root moves are generated once per search and their order is kept from
+ * one iteration to the next. The lines of the last completed iteration are
+ * kept apart, the best one first, and the next iteration searches each of them
+ * first.
+ */
+typedef struct search_thread {
+	pthread_t handle;
+	size_t idx;
+	Position *pos;
+	RootMove root_moves[MAX_MOVES];
+	size_t num_root_moves;
+	RootLine lines[MAX_MULTI_PV];
+	size_t num_lines;
+	size_t line;
+	_Atomic u64 nodes;
+	int calls_since_check;
+	SearchStack stack[MAX_PLY + 2];
+	SearchStats stats;
+	int history[2][64][64];
+	Move counter_moves[PIECE_BLACK_KING + 1][64];
+} SearchThread;
+
+/*
+ * The history of a quiet move, indexed by the side to move and the origin and
+ * target squares, grows every time the move causes a beta cutoff and shrinks
+ * every time another quiet move does after it was searched. Each update moves
+ * the value towards the bonus proportionally to the distance, so it stays
+ * within MAX_HISTORY and recent results weigh more than old ones.
+ *
+ * The counter move of a move is the quiet move that last refuted it, indexed by
+ * the piece moved and its target square. It's searched first among the quiet
+ * moves.
+ */
+#define MAX_HISTORY 16384
+#define MAX_HISTORY_BONUS 1200
+#define COUNTER_MOVE_SCORE (MAX_HISTORY + 1)
 
-Move killer_moves[MAX_DEPTH][MAX_KILLER_MOVES];
+/*
+ * Late move reductions, indexed by the remaining depth and the number of the
+ * move in the order it's searched. Both a deeper search and a later move
+ * justify reducing more, but the effect of each decreases the larger it is.
+ */
+static int reductions[MAX_DEPTH + 1][MAX_MOVES];
+
+/*
+ * The margins of the forward pruning, in centipawns per ply of remaining
+ * depth, except for late move pruning, where the base is the number of quiet
+ * moves searched at depth 0 and the depth squared is added to it.
+ */
+static SearchParameters parameters = {
+	.reverse_futility_margin = 75,
+	.futility_margin = 100,
+	.razoring_margin = 250,
+	.late_move_pruning_base = 3,
+};
+static const int max_reverse_futility_depth = 6;
+static const int max_razoring_depth = 3;
+static const int max_futility_depth = 3;
+static const int max_late_move_pruning_depth = 3;
+
+static SearchThread threads[MAX_THREADS];
+static size_t num_threads = 1;
+static size_t multi_pv = 1;
+static atomic_bool stop_search;
+static atomic_bool pondering;
+
+static bool search_is_stopped(void)
+{
+	return atomic_load_explicit(&stop_search, memory_order_relaxed);
+}
+
+/*
+ * Only the thread itself changes its node count, so it doesn't need an atomic
+ * increment, but the main thread reads it to enforce the node limit.
+ */
+static void count_node(SearchThread *thread)
+{
+	const u64 nodes = atomic_load_explicit(&thread->nodes, memory_order_relaxed);
+	atomic_store_explicit(&thread->nodes, nodes + 1, memory_order_relaxed);
+}
+
+static void count_qnode(SearchThread *thread)
+{
+	const u64 qnodes = atomic_load_explicit(&thread->stats.qnodes, memory_order_relaxed);
+	atomic_store_explicit(&thread->stats.qnodes, qnodes + 1, memory_order_relaxed);
+	count_node(thread);
+}
+
+static u64 get_thread_nodes(const SearchThread *thread)
+{
+	return atomic_load_explicit(&thread->nodes, memory_order_relaxed);
+}
+
+static u64 get_total_nodes(void)
+{
+	u64 nodes = 0;
+	for (size_t i = 0; i < num_threads; ++i)
+		nodes += get_thread_nodes(&threads[i]);
+	return nodes;
+}
+
+static u64 get_total_qnodes(void)
+{
+	u64 qnodes = 0;
+	for (size_t i = 0; i < num_threads; ++i)
+		qnodes += atomic_load_explicit(&threads[i].stats.qnodes, memory_order_relaxed);
+	return qnodes;
+}
+
+/*
+ * Probe the transposition table and keep count of the probes and hits. Mate
+ * scores are stored relative to the node, since the same position can be
+ * reached at different plies, and they are made relative to the root again
+ * here.
+ */
+static bool probe_tt(SearchThread *thread, const SearchStack *ss, NodeData *data)
+{
+	++thread->stats.tt_probes;
+	if (!tt_get(data, pos_get_key(thread->pos)))
+		return false;
+	++thread->stats.tt_hits;
+	if (data->score > MATE_BOUND)
+		data->score -= ss->ply;
+	else if (data->score < -MATE_BOUND)
+		data->score += ss->ply;
+	return true;
+}
+
+static void store_tt(SearchThread *thread, const SearchStack *ss, int score, int depth,
+                     NodeType type, Move best_move)
+{
+	if (score > MATE_BOUND)
+		score += ss->ply;
+	else if (score < -MATE_BOUND)
+		score -= ss->ply;
+	NodeData data;
+	tt_entry_init(&data, score, depth, type, best_move, pos_get_key(thread->pos));
+	tt_store(&data);
+}
+
+/*
+ * The soft time limit is the time the search should take, it's only checked
+ * between iterations and it's scaled by how stable the best move is. The hard
+ * limit is checked during the search, which is aborted when it's reached. A
+ * limit of 0 means there is no limit.
+ */
+static struct budget {
+	bool pondering;
+	u64 start_time;
+	u64 soft_time;
+	u64 hard_time;
+	u64 nodes;
+} budget;
+
+/*
+ * When the search started, for reporting. The budget starts later when
+ * pondering.
+ */
+static u64 search_start_time;
+
+/*
+ * Number of calls to the search functions between two checks of the budget by
+ * the main thread.
+ */
+#define CALLS_BETWEEN_CHECKS 1024
+
+/*
+ * Split the remaining time among the moves until the next time control, 30 if
+ * the GUI doesn't say, and add most of the increment. The search may use up
+ * to 3 times that when an iteration takes longer than expected, but never
+ * more than 3/4 of what is left after keeping the move overhead in reserve.
+ * A fixed time per move has no soft limit, all of it is used.
+ */
+static void init_budget(const SearchLimits *limits, Color c)
+{
+	const int default_moves_to_go = 30;
+	const int max_moves_to_go = 50;
+
+	budget.pondering = limits->ponder;
+	budget.start_time = clock_get_time_in_ms();
+	budget.soft_time = 0;
+	budget.hard_time = 0;
+	budget.nodes = limits->nodes;
+	if (limits->infinite)
+		return;
+
+	if (limits->move_time > 0) {
+		const long time = limits->move_time - limits->move_overhead;
+		budget.hard_time = time > 1 ? time : 1;
+	} else if (limits->use_clock[c]) {
+		const long time = limits->time[c] - limits->move_overhead;
+		const long available = time > 1 ? time : 1;
+		int moves_to_go = limits->moves_to_go > 0 ? limits->moves_to_go : default_moves_to_go;
+		moves_to_go = moves_to_go < max_moves_to_go ? moves_to_go : max_moves_to_go;
+		const long increment = limits->increment[c] > 0 ? limits->increment[c] : 0;
+
+		const long max_time = available * 3 / 4;
+		long soft_time = available / moves_to_go + increment * 3 / 4;
+		soft_time = soft_time < max_time ? soft_time : max_time;
+		long hard_time = soft_time * 3;
+		hard_time = hard_time < max_time ? hard_time : max_time;
+		budget.soft_time = soft_time > 1 ? soft_time : 1;
+		budget.hard_time = hard_time > 1 ? hard_time : 1;
+	}
+}
+
+/*
+ * Return true while the search is pondering. The budget is only spent from
+ * the ponder hit on, so the clock starts when the main thread notices it.
+ */
+static bool budget_is_on_hold(void)
+{
+	if (!budget.pondering)
+		return false;
+	if (atomic_load(&pondering))
+		return true;
+	budget.pondering = false;
+	budget.start_time = clock_get_time_in_ms();
+	return false;
+}
+
+/*
+ * Only the main thread checks the hard limits, the other threads are stopped
+ * through the stop flag. The clock isn't read at every node because it's too
+ * slow.
+ */
+static void check_budget(SearchThread *thread)
+{
+	if (thread->idx || ++thread->calls_since_check < CALLS_BETWEEN_CHECKS)
+		return;
+	thread->calls_since_check = 0;
+	if (budget_is_on_hold())
+		return;
+	const u64 elapsed = clock_get_time_in_ms() - budget.start_time;
+	if (budget.hard_time && elapsed >= budget.hard_time)
+		atomic_store(&stop_search, true);
+	if (budget.nodes && get_total_nodes() >= budget.nodes)
+		atomic_store(&stop_search, true);
+}
+
+/*
+ * The next iteration takes longer than all the previous ones together, so
+ * it's not started if it would most likely be aborted anyway. The soft limit
+ * shrinks the more iterations the best move has been the same and grows when
+ * it has just changed.
+ */
+static bool soft_time_is_over(int stable_iterations)
+{
+	if (budget_is_on_hold() || !budget.soft_time)
+		return false;
+	const int percentages[] = {140, 100, 85, 70, 60, 50};
+	const int max_idx = sizeof(percentages) / sizeof(percentages[0]) - 1;
+	const int idx = stable_iterations < max_idx ? stable_iterations : max_idx;
+	const u64 soft_time = budget.soft_time * percentages[idx] / 100;
+	const u64 elapsed = clock_get_time_in_ms() - budget.start_time;
+	return elapsed >= soft_time / 2;
+}
 
 /*
  * This function stores a new killer move by shifting all the killer moves for
- * a certain depth, discarding the move in the last slot, the oldest one, and
+ * a certain ply, discarding the move in the last slot, the oldest one, and
  * then places the new move in the first slot. It is important that all the
  * slots contain different moves, otherwise we waste computation time in move
  * ordering looking for the same killer move again.
  */
-static void store_killer(Move move, int depth)
+static void store_killer(SearchStack *ss, Move move)
 {
-	const size_t depth_idx = depth - 1;;
+	Move *const killer_moves = ss->killers;
 
 	for (int i = 0; i < MAX_KILLER_MOVES; ++i) {
-		if (move == killer_moves[depth_idx][i])
+		if (move == killer_moves[i])
 			return;
 	}
 	for (int i = MAX_KILLER_MOVES - 1; i > 0; --i)
-		killer_moves[depth_idx][i] = killer_moves[depth_idx][i - 1];
-	killer_moves[depth_idx][0] = move;
+		killer_moves[i] = killer_moves[i - 1];
+	killer_moves[0] = move;
 }
 
-static bool is_killer(Move move, int depth)
+static void update_history(int *entry, int bonus)
 {
-	for (int i = 0; i < MAX_KILLER_MOVES; ++i) {
-		Move killer = killer_moves[depth - 1][i];
-		if (killer && move == killer)
-			return true;
+	*entry += bonus - *entry * abs(bonus) / MAX_HISTORY;
+}
+
+/*
+ * Reward the quiet move that caused a beta cutoff and punish the quiet moves
+ * searched before it, which failed to. The deeper the node, the more the
+ * result is worth.
+ */
+static void update_quiet_stats(SearchThread *thread, SearchStack *ss, Move move,
+                               const Move *failed_quiets, size_t num_failed_quiets, int depth)
+{
+	const Color c = pos_get_side_to_move(thread->pos);
+	const int bonus = depth * depth < MAX_HISTORY_BONUS ? depth * depth : MAX_HISTORY_BONUS;
+
+	store_killer(ss, move);
+	update_history(&thread->history[c][move_get_origin(move)][move_get_target(move)], bonus);
+	for (size_t i = 0; i < num_failed_quiets; ++i) {
+		const Move failed = failed_quiets[i];
+		update_history(&thread->history[c][move_get_origin(failed)][move_get_target(failed)], -bonus);
 	}
-	return false;
+
+	const Move previous_move = ss->move;
+	if (previous_move) {
+		const Square sq = move_get_target(previous_move);
+		thread->counter_moves[pos_get_piece_at(thread->pos, sq)][sq] = move;
+	}
+}
+
+static Move get_counter_move(const SearchThread *thread, const SearchStack *ss)
+{
+	const Move previous_move = ss->move;
+	if (!previous_move)
+		return 0;
+	const Square sq = move_get_target(previous_move);
+	return thread->counter_moves[pos_get_piece_at(thread->pos, sq)][sq];
+}
+
+/*
+ * Make the move of the node in the frame and prepare the frame of the node
+ * after it. A null move is 0.
+ */
+static void make_move(SearchThread *thread, SearchStack *ss, Move move)
+{
+	if (move)
+		move_do(thread->pos, move);
+	else
+		move_do_null(thread->pos);
+	(ss + 1)->ply = ss->ply + 1;
+	(ss + 1)->move = move;
+}
+
+static void unmake_move(SearchThread *thread, Move move)
+{
+	if (move)
+		move_undo(thread->pos, move);
+	else
+		move_undo_null(thread->pos);
+}
+
+/*
+ * Make the move the start of the principal variation of the node, followed by
+ * the one of the node after it, which the move led to.
+ */
+static void update_pv(SearchStack *ss, Move move)
+{
+	const int child_len = ss->ply < MAX_PLY ? (ss + 1)->pv_len : 0;
+	ss->pv[0] = move;
+	memcpy(&ss->pv[1], (ss + 1)->pv, child_len * sizeof(Move));
+	ss->pv_len = child_len + 1;
+}
+
+/*
+ * Return the move of the principal variation that the line being searched had
+ * in the previous iteration at the current ply if the moves played so far
+ * follow it, or 0 otherwise.
+ */
+static Move get_previous_pv_move(const SearchThread *thread, const SearchStack *ss)
+{
+	const int ply = ss->ply;
+	if (thread->line >= thread->num_lines)
+		return 0;
+	const RootLine *const line = &thread->lines[thread->line];
+	if (ply >= line->pv_len)
+		return 0;
+	for (int i = 0; i < ply; ++i) {
+		if (thread->stack[i + 1].move != line->pv[i])
+			return 0;
+	}
+	return line->pv[ply];
+}
+
+static Move get_best_move(const SearchThread *thread)
+{
+	return thread->num_lines && thread->lines[0].pv_len ? thread->lines[0].pv[0] : 0;
 }
 
 /*
- * Return the index of what seems to be the most promising by evaluating moves.
+ * The move picker returns the moves of a position one at a time, in what seems
+ * to be the order from the most to the least promising, and generates the
+ * moves in stages so that a beta cutoff caused by one of the first moves avoids
+ * the work of generating and scoring the rest.
  *
- * The best move of PV nodes are stored in the transposition table so and since
- *  all the moves of PV nodes moves have been searched we know for sure that
- * that move is the best for that position. So the best move of PV nodes have
- * higher priority than any other moves.
+ * The best move stored in the transposition table is returned first, since it
+ * was the best move the last time this position was searched. It comes from
+ * the table so it's only tested for legality and no move is generated for it.
  *
- * The killer moves are searched next because they caused a beta cutoff and are
- * likely to cause a beta cutoff again in the rest of the moves. However, some
- * captures have the potential to make the killer move not a good choice (for
- * example, if white captures black's queen in the other branch before black
- * makes the killer move then the killer move might no longer be an option for
- * black). So very good captures have priority.
- * 
- * To simulate this priority order we have some offsets that act as the starting
- * point for the score of a move which is then added to the offset. Captures
- * have a smaller offset than killer moves, but they are still close enough for
- * captures to surpass the killer move if it is good enough and/or the killer
- * move is bad enough.
- * 
- * There is no offset for the best move of PV nodes because they are always
- * searched first, so if the position is a PV node we just return the move we
- * have in the transposition table. And other moves have offset 0 because they
- * have lower priority than captures.
- */
-static size_t get_most_promising_move(const Move *moves, size_t len, Position *pos, int depth)
-{
-	static const int capture_offset = INFINITE / 64;
-	static const int killer_offset = INFINITE / 32;
-	int best_score = -INFINITE;
-	size_t best_idx = 0;
-
-	for (size_t i = 0; i < len; ++i) {
-		const Move move = moves[i];
-		NodeData pos_data;
-		if (tt_get(&pos_data, pos) && pos_data.type == NODE_TYPE_PV) {
-			if (move == pos_data.best_move)
-				return i;
-		}
+ * The tactical moves, captures and promotions, come next, ordered by their
+ * MVV-LVA score, and then the killer moves, which caused a beta cutoff in a
+ * sibling node and are likely to cause it again. The killer moves are quiet
+ * moves, so they are also only tested for legality. Then the quiet moves are
+ * generated and ordered by their history, with the counter move of the
+ * previous move first. Captures that lose material according to the static
+ * exchange evaluation are put aside in the tactical stage and returned last.
+ * Moves that were already returned in a previous stage are skipped.
+ *
+ * The quiescence search only searches tactical moves, so its picker starts
+ * with the generation of tactical moves and stops after them.
+ *
+ * Within a stage the moves are lazily sorted, each call only looks for the best
+ * of the remaining moves instead of sorting all of them at once, so no time is
+ * wasted sorting moves of branches that are pruned.
+ */
+enum picker_stage {
+	PICKER_STAGE_TT_MOVE,
+	PICKER_STAGE_GENERATE_TACTICAL,
+	PICKER_STAGE_TACTICAL,
+	PICKER_STAGE_KILLERS,
+	PICKER_STAGE_GENERATE_QUIETS,
+	PICKER_STAGE_QUIETS,
+	PICKER_STAGE_BAD_TACTICAL,
+	PICKER_STAGE_DONE,
+};
+
+typedef struct move_picker {
+	Position *pos;
+	const SearchThread *thread;
+	enum picker_stage stage;
+	bool tactical_only;
+	Move tt_move;
+	Move counter_move;
+	Move killers[MAX_KILLER_MOVES];
+	size_t index;
+	MoveList list;
+	int scores[MAX_MOVES];
+	Move bad_tactical[MAX_MOVES];
+	size_t num_bad_tactical;
+} MovePicker;
+
+static bool is_tactical(Move move)
+{
+	return move_is_capture(move) || move_is_promotion(move);
+}
+
+static void picker_init(MovePicker *picker, const SearchThread *thread, const SearchStack *ss,
+                        Move tt_move, Move counter_move)
+{
+	picker->pos = thread->pos;
+	picker->thread = thread;
+	picker->stage = PICKER_STAGE_TT_MOVE;
+	picker->tactical_only = false;
+	picker->tt_move = tt_move;
+	picker->counter_move = counter_move;
+	picker->num_bad_tactical = 0;
+	for (size_t i = 0; i < MAX_KILLER_MOVES; ++i)
+		picker->killers[i] = ss->killers[i];
+	picker->index = 0;
+}
+
+static void picker_init_quiescence(MovePicker *picker, Position *pos)
+{
+	picker->pos = pos;
+	picker->thread = NULL;
+	picker->stage = PICKER_STAGE_GENERATE_TACTICAL;
+	picker->tactical_only = true;
+	picker->tt_move = 0;
+	picker->counter_move = 0;
+	picker->num_bad_tactical = 0;
+	for (size_t i = 0; i < MAX_KILLER_MOVES; ++i)
+		picker->killers[i] = 0;
+	picker->index = 0;
+}
+
+static bool picker_is_killer(const MovePicker *picker, Move move)
+{
+	for (size_t i = 0; i < MAX_KILLER_MOVES; ++i) {
+		if (move == picker->killers[i])
+			return true;
 	}
+	return false;
+}
 
-	for (size_t i = 0; i < len; ++i) {
-		const Move move = moves[i];
-		int score = 0;
-		if (is_killer(move, depth))
-			score = killer_offset + eval_evaluate_move(move, pos);
-		else if (move_is_capture(move))
-			score = capture_offset + eval_evaluate_move(move, pos);
-		else
-			score = eval_evaluate_move(move, pos);
+static int picker_score_quiet(const MovePicker *picker, Move move)
+{
+	if (move == picker->counter_move)
+		return COUNTER_MOVE_SCORE;
+	const Color c = pos_get_side_to_move(picker->pos);
+	return picker->thread->history[c][move_get_origin(move)][move_get_target(move)];
+}
 
-		if (score > best_score) {
-			best_idx = i;
-			best_score = score;
-		}
+/*
+ * Return the remaining move of the list with the highest score and remove it
+ * from the remaining moves, or 0 if there are no moves left.
+ */
+static Move picker_select_best(MovePicker *picker)
+{
+	MoveList *const list = &picker->list;
+	if (picker->index >= list->len)
+		return 0;
+
+	size_t best = picker->index;
+	for (size_t i = picker->index + 1; i < list->len; ++i) {
+		if (picker->scores[i] > picker->scores[best])
+			best = i;
 	}
+	const Move move = list->moves[best];
+	const int score = picker->scores[best];
+	list->moves[best] = list->moves[picker->index];
+	picker->scores[best] = picker->scores[picker->index];
+	list->moves[picker->index] = move;
+	picker->scores[picker->index] = score;
+	++picker->index;
+	return move;
+}
 
-	return best_idx;
+/*
+ * Return the next move to be searched, or 0 when all the legal moves have been
+ * returned.
+ */
+static Move picker_next(MovePicker *picker)
+{
+	Position *const pos = picker->pos;
+	Move move;
+
+	switch (picker->stage) {
+	case PICKER_STAGE_TT_MOVE:
+		picker->stage = PICKER_STAGE_GENERATE_TACTICAL;
+		if (movegen_is_move_legal(pos, picker->tt_move))
+			return picker->tt_move;
+		picker->tt_move = 0;
+		/* fall through */
+	case PICKER_STAGE_GENERATE_TACTICAL:
+		movegen_get_legal_tactical_moves(pos, &picker->list);
+		for (size_t i = 0; i < picker->list.len; ++i)
+			picker->scores[i] = eval_compute_mvv_lva_score(picker->list.moves[i], pos);
+		picker->index = 0;
+		picker->stage = PICKER_STAGE_TACTICAL;
+		/* fall through */
+	case PICKER_STAGE_TACTICAL:
+		while ((move = picker_select_best(picker))) {
+			if (move == picker->tt_move)
+				continue;
+			/* The quiescence search prunes the losing captures
+			 * itself. */
+			if (!picker->tactical_only && !move_is_promotion(move)
+			    && !eval_see(pos, move, 0)) {
+				picker->bad_tactical[picker->num_bad_tactical++] = move;
+				continue;
+			}
+			return move;
+		}
+		if (picker->tactical_only) {
+			picker->stage = PICKER_STAGE_DONE;
+			return 0;
+		}
+		picker->index = 0;
+		picker->stage = PICKER_STAGE_KILLERS;
+		/* fall through */
+	case PICKER_STAGE_KILLERS:
+		while (picker->index < MAX_KILLER_MOVES) {
+			move = picker->killers[picker->index++];
+			if (move && move != picker->tt_move &&
+			    !is_tactical(move) && movegen_is_move_legal(pos, move))
+				return move;
+			/* Killers that can't be played here are dropped so
+			 * they're not skipped in the quiet moves stage. */
+			picker->killers[picker->index - 1] = 0;
+		}
+		picker->stage = PICKER_STAGE_GENERATE_QUIETS;
+		/* fall through */
+	case PICKER_STAGE_GENERATE_QUIETS:
+		movegen_get_legal_quiet_moves(pos, &picker->list);
+		for (size_t i = 0; i < picker->list.len; ++i)
+			picker->scores[i] = picker_score_quiet(picker, picker->list.moves[i]);
+		picker->index = 0;
+		picker->stage = PICKER_STAGE_QUIETS;
+		/* fall through */
+	case PICKER_STAGE_QUIETS:
+		while ((move = picker_select_best(picker))) {
+			if (move != picker->tt_move && !picker_is_killer(picker, move))
+				return move;
+		}
+		picker->index = 0;
+		picker->stage = PICKER_STAGE_BAD_TACTICAL;
+		/* fall through */
+	case PICKER_STAGE_BAD_TACTICAL:
+		if (picker->index < picker->num_bad_tactical)
+			return picker->bad_tactical[picker->index++];
+		picker->stage = PICKER_STAGE_DONE;
+		/* fall through */
+	case PICKER_STAGE_DONE:
+		return 0;
+	}
+	return 0;
 }
 
 static bool is_in_check(const Position *pos)
@@ -119,173 +698,899 @@ static bool is_in_check(const Position *pos)
 	return movegen_is_square_attacked(king_sq, !c, pos);
 }
 
-static int quiescence_search(Position *pos, int alpha, int beta, int *nodes)
+/*
+ * The stored score can only be used when its bound decides the result within
+ * the window: an exact score always does, a lower bound only when it's at
+ * least beta and an upper bound only when it's at most alpha.
+ */
+static bool tt_score_is_usable(const NodeData *data, int alpha, int beta)
 {
-	int score = eval_evaluate(pos);
+	switch (data->type) {
+	case NODE_TYPE_PV:
+		return true;
+	case NODE_TYPE_CUT:
+		return data->score >= beta;
+	case NODE_TYPE_ALL:
+		return data->score <= alpha;
+	}
+	return false;
+}
+
+static int clamp_score(int score, int alpha, int beta)
+{
+	return score < alpha ? alpha : (score > beta ? beta : score);
+}
+
+/*
+ * Only tactical moves that don't lose material are searched, ordered by their
+ * MVV-LVA score, until the position is quiet. Any score in the transposition
+ * table comes from a search at least as deep as this one, so it's returned
+ * right away if its bound allows it.
+ */
+static int quiescence_search(SearchThread *thread, SearchStack *ss, int alpha, int beta)
+{
+	Position *const pos = thread->pos;
+	check_budget(thread);
+	if (search_is_stopped())
+		return 0;
+	if (ss->ply > thread->stats.seldepth)
+		thread->stats.seldepth = ss->ply;
+
+	NodeData pos_data;
+	if (probe_tt(thread, ss, &pos_data)
+	    && tt_score_is_usable(&pos_data, alpha, beta))
+		return clamp_score(pos_data.score, alpha, beta);
+	ss->static_eval = eval_evaluate(pos);
+	if (ss->ply >= MAX_PLY)
+		return ss->static_eval;
+
+	int score = ss->static_eval;
 	alpha = score > alpha ? score : alpha;
+	if (alpha >= beta)
+		return alpha;
 
-	size_t len;
-	Move *moves = movegen_get_pseudo_legal_moves(pos, &len);
-	for (size_t i = 0; i < len; ++i) {
-		Move move = moves[i];
-		if (!move_is_legal(pos, move) || !move_is_capture(move))
+	MovePicker picker;
+	picker_init_quiescence(&picker, pos);
+	Move move;
+	while ((move = picker_next(&picker))) {
+		/* A capture that loses material can't raise the score above
+		 * standing pat. */
+		if (!move_is_promotion(move) && !eval_see(pos, move, 0))
 			continue;
-		move_do(pos, move);
-		score = -quiescence_search(pos, -beta, -alpha, nodes);
-		move_undo(pos, move);
-		++*nodes;
+		make_move(thread, ss, move);
+		score = -quiescence_search(thread, ss + 1, -beta, -alpha);
+		unmake_move(thread, move);
+		count_qnode(thread);
 		alpha = score > alpha ? score : alpha;
 		if (alpha >= beta)
 			break;
 	}
-	free(moves);
 
 	return alpha;
 }
 
+static int alpha_beta(SearchThread *thread, SearchStack *ss, int depth, int alpha, int beta,
+                      bool allow_null);
+
+/*
+ * Principal variation search: the first move is expected to be the best one
+ * so it's searched with the full window, and the rest are only proved to be
+ * worse with a null window, which is much cheaper. A move that turns out to be
+ * better after all is searched again with the full window to get its score.
+ * The move has already been made, from the node in the frame.
+ *
+ * The null window search of a late move can be reduced, in which case a move
+ * that beats alpha is searched again without the reduction first, since the
+ * reduced search might have missed why it's not so good.
+ */
+static int search_move(SearchThread *thread, SearchStack *ss, int depth, int alpha, int beta,
+                       bool is_first, int reduction)
+{
+	SearchStack *const child = ss + 1;
+	if (is_first)
+		return -alpha_beta(thread, child, depth - 1, -beta, -alpha, true);
+	int score = -alpha_beta(thread, child, depth - 1 - reduction, -alpha - 1, -alpha, true);
+	if (reduction && score > alpha)
+		score = -alpha_beta(thread, child, depth - 1, -alpha - 1, -alpha, true);
+	if (score > alpha && score < beta)
+		return -alpha_beta(thread, child, depth - 1, -beta, -alpha, true);
+	return score;
+}
+
+/*
+ * Without pieces other than pawns the side to move is often in zugzwang, where
+ * passing would be better than any move, so the null move can't be trusted.
+ */
+static bool has_non_pawn_material(const Position *pos, Color c)
+{
+	const u64 pawns = pos_get_piece_bitboard(pos, pos_make_piece(PIECE_TYPE_PAWN, c));
+	const u64 king = pos_get_piece_bitboard(pos, pos_make_piece(PIECE_TYPE_KING, c));
+	return pos_get_color_bitboard(pos, c) & ~(pawns | king);
+}
+
 /*
- * It will return MAX_INT on checkmate and 0 on stalemate.
+ * If the side to move passes and a search with reduced depth still scores at
+ * least beta, a real move would most likely too, so the node is cut off
+ * without searching any move. The reduction grows with the depth, and at high
+ * depths the cutoff is verified with a reduced search of the position without
+ * null moves, in case it's a zugzwang that the material guard missed.
+ *
+ * Passing isn't possible in check, it's pointless in a PV node, where the
+ * exact score is needed, and two null moves in a row would just search the
+ * same position with less depth.
  */
-static int alpha_beta(Position *pos, int depth, int alpha, int beta, int *nodes)
+static bool null_move_cuts_off(SearchThread *thread, SearchStack *ss, int depth, int beta)
 {
+	const int min_depth = 3;
+	const int verification_depth = 8;
+	Position *const pos = thread->pos;
+
+	if (depth < min_depth || !has_non_pawn_material(pos, pos_get_side_to_move(pos))
+	    || ss->static_eval < beta)
+		return false;
+
+	const int reduction = depth > 6 ? 3 : 2;
+	const int null_depth = depth - 1 - reduction > 0 ? depth - 1 - reduction : 0;
+	make_move(thread, ss, 0);
+	const int score = -alpha_beta(thread, ss + 1, null_depth, -beta, -beta + 1, false);
+	unmake_move(thread, 0);
+	count_node(thread);
+	if (search_is_stopped() || score < beta)
+		return false;
+	if (depth < verification_depth)
+		return true;
+	return alpha_beta(thread, ss, null_depth, beta - 1, beta, false) >= beta;
+}
+
+/*
+ * Only the quiet moves that come after the killer moves are reduced, the
+ * moves of the earlier stages of the move picker are likely to be good. Moves
+ * that give check and moves that get out of check aren't reduced either,
+ * since they can change the evaluation a lot. PV nodes are reduced less. The
+ * move has already been made.
+ */
+static int get_reduction(const MovePicker *picker, const Position *pos, int depth,
+                         size_t move_number, bool is_pv, bool in_check)
+{
+	if (picker->stage != PICKER_STAGE_QUIETS || in_check || is_in_check(pos))
+		return 0;
+	const size_t idx = move_number < MAX_MOVES ? move_number : MAX_MOVES - 1;
+	int reduction = reductions[depth][idx] - is_pv;
+	if (reduction > depth - 1)
+		reduction = depth - 1;
+	return reduction > 0 ? reduction : 0;
+}
+
+/*
+ * It will return -INFINITE plus the ply when the side to move is checkmated
+ * and 0 on stalemate. Once the search is stopped the score returned is meaningless and
+ * nothing is stored.
+ */
+static int alpha_beta(SearchThread *thread, SearchStack *ss, int depth, int alpha, int beta,
+                      bool allow_null)
+{
+	Position *const pos = thread->pos;
+	check_budget(thread);
+	if (search_is_stopped())
+		return 0;
+
 	NodeData pos_data;
-	if (tt_get(&pos_data, pos) && pos_data.depth >= depth)
-		return pos_data.score;
+	ss->pv_len = 0;
+	if (ss->ply > thread->stats.seldepth)
+		thread->stats.seldepth = ss->ply;
+	const bool is_pv = beta - alpha > 1;
+	/* A PV node is always searched so that it has a principal variation,
+	 * the entry only helps ordering the moves. */
+	const bool has_data = probe_tt(thread, ss, &pos_data);
+	if (!is_pv && has_data && pos_data.depth >= depth
+	    && tt_score_is_usable(&pos_data, alpha, beta))
+		return clamp_score(pos_data.score, alpha, beta);
 	if (!depth)
-		return quiescence_search(pos, alpha, beta, nodes);
+		return quiescence_search(thread, ss, alpha, beta);
 
-	NodeType type = NODE_TYPE_ALL;
-	size_t len = 0;
-	Move *moves = movegen_get_pseudo_legal_moves(pos, &len);
-	if (!len) {
-		if (is_in_check(pos))
-			return INT_MAX;
-		else
+	for (size_t i = 0; i < MAX_KILLER_MOVES; ++i)
+		(ss + 2)->killers[i] = 0;
+	const bool in_check = is_in_check(pos);
+	const bool can_prune = !is_pv && !in_check;
+	ss->static_eval = can_prune ? eval_evaluate(pos) : 0;
+
+	/* Reverse futility pruning: the opponent is unlikely to make up for
+	 * such a large advantage in the few plies left. */
+	if (can_prune && depth <= max_reverse_futility_depth
+	    && ss->static_eval - parameters.reverse_futility_margin * depth >= beta)
+		return beta;
+
+	/* Razoring: with such a large disadvantage only tactical moves could
+	 * help, so the quiescence search decides. */
+	if (can_prune && depth <= max_razoring_depth
+	    && ss->static_eval + parameters.razoring_margin * depth <= alpha) {
+		const int score = quiescence_search(thread, ss, alpha, alpha + 1);
+		if (search_is_stopped())
 			return 0;
+		if (score <= alpha)
+			return alpha;
 	}
-	Move *moves_ptr = moves;
-	size_t legal_moves_cnt = 0;
-	Move best_move;
-	do {
-		/* Lazily sort moves instead of doing it all at once, this way
-		 * we avoid wasting time sorting moves of branches that are
-		 * pruned. */
-		if (len > 1) {
-			Move first = moves[0];
-			size_t i = get_most_promising_move(moves, len, pos, depth);
-			Move most_promising = moves[i];
-			moves[0] = most_promising;
-			moves[i] = first;
-		}
 
-		Move move = *moves;
-		if (!move_is_legal(pos, move)) {
-			--len;
-			++moves;
+	if (allow_null && can_prune && null_move_cuts_off(thread, ss, depth, beta)) {
+		if (search_is_stopped())
+			return 0;
+		store_tt(thread, ss, beta, depth, NODE_TYPE_CUT, 0);
+		return beta;
+	}
+
+	/* Futility pruning: near the leaves a quiet move can't raise the
+	 * score enough to beat alpha. */
+	const bool futile = can_prune && depth <= max_futility_depth
+		&& ss->static_eval + parameters.futility_margin * depth <= alpha;
+	/* Late move pruning: near the leaves the quiet moves that come late in
+	 * the order are very unlikely to be any good. */
+	const size_t max_quiets = depth <= max_late_move_pruning_depth
+		? parameters.late_move_pruning_base + depth * depth : MAX_MOVES;
+	size_t num_quiets = 0;
+
+	NodeType type = NODE_TYPE_ALL;
+	Move tt_move = has_data ? pos_data.best_move : 0;
+	/* The transposition table entries along the principal variation might
+	 * have been replaced. */
+	if (is_pv && get_previous_pv_move(thread, ss))
+		tt_move = get_previous_pv_move(thread, ss);
+	MovePicker picker;
+	picker_init(&picker, thread, ss, tt_move, get_counter_move(thread, ss));
+	size_t legal_moves_cnt = 0;
+	Move best_move = 0;
+	Move failed_quiets[MAX_MOVES];
+	size_t num_failed_quiets = 0;
+	Move move;
+	while ((move = picker_next(&picker))) {
+		++legal_moves_cnt;
+		make_move(thread, ss, move);
+		if (picker.stage == PICKER_STAGE_QUIETS && legal_moves_cnt > 1
+		    && can_prune && !is_in_check(pos)
+		    && (futile || ++num_quiets > max_quiets)) {
+			unmake_move(thread, move);
 			continue;
 		}
-		++legal_moves_cnt;
-		move_do(pos, move);
-		int score = -alpha_beta(pos, depth - 1, -beta, -alpha, nodes);
-		move_undo(pos, move);
-		++*nodes;
+		const int reduction = get_reduction(&picker, pos, depth, legal_moves_cnt, is_pv, in_check);
+		int score = search_move(thread, ss, depth, alpha, beta, legal_moves_cnt == 1, reduction);
+		unmake_move(thread, move);
+		count_node(thread);
+		if (search_is_stopped())
+			return 0;
 		if (score > alpha) {
 			alpha = score;
 			best_move = move;
 			type = NODE_TYPE_PV;
+			update_pv(ss, move);
 		}
 		if (alpha >= beta) {
-			if (!move_is_capture(move))
-				store_killer(move, depth);
+			if (!is_tactical(move))
+				update_quiet_stats(thread, ss, move, failed_quiets, num_failed_quiets, depth);
+			++thread->stats.cutoffs;
+			if (legal_moves_cnt == 1)
+				++thread->stats.first_move_cutoffs;
 			type = NODE_TYPE_CUT;
 			break;
 		}
-
-		--len;
-		++moves;
-	} while (len);
-	free(moves_ptr);
+		if (!is_tactical(move))
+			failed_quiets[num_failed_quiets++] = move;
+	}
 	if (!legal_moves_cnt) {
-		if (is_in_check(pos))
-			return INFINITE;
+		if (in_check)
+			return -INFINITE + ss->ply;
 		else
 			return 0;
 	}
 
-	tt_entry_init(&pos_data, alpha, depth, type, best_move, pos);
-	tt_store(&pos_data);
+	store_tt(thread, ss, alpha, depth, type, best_move);
 	return alpha;
 }
 
-void search_init(void)
+static void clear_thread_move_ordering(SearchThread *thread)
 {
-	for (size_t i = 0; i < MAX_DEPTH; ++i) {
-		for (size_t j = 0; j < MAX_KILLER_MOVES; ++j)
-			killer_moves[i][j] = 0;
+	memset(thread->stack, 0, sizeof(thread->stack));
+	memset(thread->history, 0, sizeof(thread->history));
+	memset(thread->counter_moves, 0, sizeof(thread->counter_moves));
+}
+
+/*
+ * Only the threads in use are cleared, the others are cleared when they are
+ * enabled.
+ */
+static void clear_move_ordering(void)
+{
+	for (size_t t = 0; t < num_threads; ++t)
+		clear_thread_move_ordering(&threads[t]);
+}
+
+static void init_reductions(void)
+{
+	for (int depth = 1; depth <= MAX_DEPTH; ++depth) {
+		for (int i = 1; i < MAX_MOVES; ++i)
+			reductions[depth][i] = 0.5 + log(depth) * log(i) / 2.0;
 	}
-	tt_init();
+}
+
+void search_init(size_t hash_size_mb)
+{
+	init_reductions();
+	clear_move_ordering();
+	tt_init(hash_size_mb);
 	eval_init();
 }
 
+/*
+ * Return the size in bytes actually used by the transposition table.
+ */
+size_t search_set_hash_size(size_t size_mb)
+{
+	return tt_resize(size_mb);
+}
+
+/*
+ * Set the number of threads used by the next searches, at least 1 and at most
+ * MAX_THREADS.
+ */
+void search_set_threads(size_t n)
+{
+	n = n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : n);
+	for (size_t t = num_threads; t < n; ++t)
+		clear_thread_move_ordering(&threads[t]);
+	num_threads = n;
+}
+
+/*
+ * Set the number of lines searched by the next searches, at least 1 and at most
+ * MAX_MULTI_PV.
+ */
+void search_set_multi_pv(size_t n)
+{
+	multi_pv = n < 1 ? 1 : (n > MAX_MULTI_PV ? MAX_MULTI_PV : n);
+}
+
+void search_set_parameters(const SearchParameters *new_parameters)
+{
+	parameters = *new_parameters;
+}
+
 void search_finish(void)
 {
 	tt_finish();
 }
 
-static Move search(Position *pos, int depth)
+/*
+ * Forget everything learned in previous searches, so the next search behaves
+ * as if it was the first one.
+ */
+void search_clear(void)
 {
-	const Move null_move = 0;
+	clear_move_ordering();
+	tt_clear();
+}
 
-	size_t len;
-	Move *moves = movegen_get_pseudo_legal_moves(pos, &len);
+/*
+ * Move the root move at index i to first, keeping the order of the moves in
+ * between.
+ */
+static void move_root_move_to(SearchThread *thread, size_t i, size_t first)
+{
+	const RootMove root_move = thread->root_moves[i];
+	memmove(&thread->root_moves[first + 1], &thread->root_moves[first],
+	        (i - first) * sizeof(RootMove));
+	thread->root_moves[first] = root_move;
+}
 
-	int alpha = -INFINITE, beta = INFINITE;
-	Move best_move = null_move;
-	int nodes = 0;
-	for (size_t i = 0; i < len; ++i) {
-		Move move = moves[i];
-		if (!move_is_legal(pos, move))
-			continue;
-		move_do(pos, move);
-		int score = -alpha_beta(pos, depth - 1, -beta, -alpha, &nodes);
-		nodes += 1;
-		move_undo(pos, move);
+/*
+ * Search the root moves from first on within the window, in their order. The
+ * one that scores the highest above alpha, if any, is moved to first along with
+ * the principal variation of the root, so first is always the best move. The
+ * moves that don't score above alpha get -INFINITE. Without legal moves the
+ * root is scored like any other node, as checkmate or stalemate.
+ */
+static int search_root(SearchThread *thread, int depth, int alpha, int beta, size_t first)
+{
+	SearchStack *const ss = &thread->stack[0];
+	ss->pv_len = 0;
+	if (!thread->num_root_moves)
+		return is_in_check(thread->pos) ? -INFINITE : 0;
+	size_t best = first;
+	for (size_t i = first; i < thread->num_root_moves; ++i) {
+		RootMove *const root_move = &thread->root_moves[i];
+		const Move move = root_move->move;
+		const u64 start_nodes = get_thread_nodes(thread);
+		make_move(thread, ss, move);
+		int score = search_move(thread, ss, depth, alpha, beta, i == first, 0);
+		count_node(thread);
+		unmake_move(thread, move);
+		root_move->nodes += get_thread_nodes(thread) - start_nodes;
+		if (search_is_stopped())
+			break;
+		root_move->score = -INFINITE;
 		if (score > alpha) {
 			alpha = score;
-			best_move = move;
+			root_move->score = score;
+			best = i;
+			update_pv(ss, move);
 		}
 		if (alpha >= beta)
 			break;
 	}
-	/* Play any move if no best move was found (probably because all moves
-	 * lead to a checkmate or stalemate.) */
-	if (best_move == null_move && len != 0) {
-		for (size_t i = 0; i < len; ++i) {
-			if (move_is_legal(pos, moves[i]))
-				best_move = moves[i];
+	/* If no move scored above alpha (probably because all moves lead to a
+	 * checkmate or stalemate) the first one stays the best. */
+	if (best != first)
+		move_root_move_to(thread, best, first);
+	return alpha;
+}
+
+/*
+ * Store the best move and the principal variation of the root in the line, or
+ * just the best move if the root has none, which happens when no move scored
+ * above alpha.
+ */
+static void save_line(const SearchThread *thread, Move best_move, int score, RootLine *line)
+{
+	line->score = score;
+	const SearchStack *const root = &thread->stack[0];
+	if (root->pv_len && root->pv[0] == best_move) {
+		memcpy(line->pv, root->pv, root->pv_len * sizeof(Move));
+		line->pv_len = root->pv_len;
+	} else {
+		line->pv[0] = best_move;
+		line->pv_len = best_move ? 1 : 0;
+	}
+}
+
+/*
+ * The score rarely changes much from one iteration to the next, so the search
+ * starts with a narrow window around the previous score of the move searched
+ * first, the best of the line in the previous iteration, which prunes more. If
+ * the score falls outside of it, the window is widened on that side and the
+ * position is searched again. The first iterations are too unstable for it.
+ *
+ * The line, made of the root moves from first on, is stored in result, even if
+ * the search is stopped before it's complete.
+ */
+static void search_line(SearchThread *thread, int depth, size_t first, RootLine *result)
+{
+	const int min_aspiration_depth = 4;
+	const int initial_window = 25;
+	const int max_window = 1000;
+
+	const int previous_score = first < thread->num_root_moves
+		? thread->root_moves[first].previous_score : -INFINITE;
+	int window = initial_window;
+	int alpha = -INFINITE, beta = INFINITE;
+	if (previous_score != -INFINITE && depth >= min_aspiration_depth) {
+		alpha = previous_score - window > -INFINITE ? previous_score - window : -INFINITE;
+		beta = previous_score + window < INFINITE ? previous_score + window : INFINITE;
+	}
+
+	int score;
+	for (;;) {
+		score = search_root(thread, depth, alpha, beta, first);
+		if (search_is_stopped())
+			break;
+		if ((score > alpha || alpha == -INFINITE) && (score < beta || beta == INFINITE))
+			break;
+		window *= 2;
+		if (window > max_window)
+			window = INFINITE;
+		if (score <= alpha)
+			alpha = score - window > -INFINITE ? score - window : -INFINITE;
+		else
+			beta = score + window < INFINITE ? score + window : INFINITE;
+	}
+	const Move best_move = first < thread->num_root_moves ? thread->root_moves[first].move : 0;
+	save_line(thread, best_move, score, result);
+}
+
+/*
+ * Put the root moves of the lines first, from the best to the worst like the
+ * lines, and then the rest from the one with the largest subtree to the one
+ * with the smallest, since a move that took more work to refute is more
+ * likely to become the best.
+ */
+static void sort_root_moves(SearchThread *thread, RootLine *lines, size_t num_lines)
+{
+	RootMove *const root_moves = thread->root_moves;
+	/* A later line can score better than an earlier one when the search
+	 * is unstable. */
+	for (size_t i = 1; i < num_lines; ++i) {
+		const RootLine line = lines[i];
+		const RootMove root_move = root_moves[i];
+		size_t j = i;
+		for (; j > 0 && lines[j - 1].score < line.score; --j) {
+			lines[j] = lines[j - 1];
+			root_moves[j] = root_moves[j - 1];
 		}
+		lines[j] = line;
+		root_moves[j] = root_move;
 	}
-	free(moves);
+	for (size_t i = num_lines + 1; i < thread->num_root_moves; ++i) {
+		const RootMove root_move = root_moves[i];
+		size_t j = i;
+		for (; j > num_lines && root_moves[j - 1].nodes < root_move.nodes; --j)
+			root_moves[j] = root_moves[j - 1];
+		root_moves[j] = root_move;
+	}
+}
+
+/*
+ * Search as many lines as requested, or root moves there are, each one with
+ * the root moves of the lines before it left out, so every line starts with a
+ * different move and gets an exact score. The helper threads only search the
+ * best line.
+ *
+ * The lines of the thread are updated, from the best to the worst, unless the
+ * search is stopped before the iteration is complete. Then the best line is
+ * only updated if there was none.
+ */
+static void search(SearchThread *thread, int depth)
+{
+	RootLine lines[MAX_MULTI_PV];
+	size_t num_lines = thread->idx ? 1 : multi_pv;
+	if (num_lines > thread->num_root_moves)
+		num_lines = thread->num_root_moves ? thread->num_root_moves : 1;
+	for (size_t i = 0; i < thread->num_root_moves; ++i) {
+		thread->root_moves[i].previous_score = thread->root_moves[i].score;
+		thread->root_moves[i].nodes = 0;
+	}
+
+	size_t num_done = 0;
+	for (; num_done < num_lines; ++num_done) {
+		thread->line = num_done;
+		search_line(thread, depth, num_done, &lines[num_done]);
+		if (search_is_stopped())
+			break;
+	}
+
+	if (num_done < num_lines) {
+		if (!thread->num_lines && (num_done || lines[0].pv_len)) {
+			thread->lines[0] = lines[0];
+			thread->num_lines = 1;
+		}
+		return;
+	}
+	sort_root_moves(thread, lines, num_lines);
+	memcpy(thread->lines, lines, num_lines * sizeof(RootLine));
+	thread->num_lines = num_lines;
+}
+
+/*
+ * Generate the legal moves of the root, only the ones in search_moves unless
+ * it's empty or none of them is legal.
+ */
+static void init_root_moves(SearchThread *thread, const MoveList *search_moves)
+{
+	MoveList list;
+	movegen_get_legal_moves(thread->pos, &list);
+	thread->num_root_moves = 0;
+	for (size_t i = 0; i < list.len; ++i) {
+		bool is_searched = !search_moves->len;
+		for (size_t j = 0; j < search_moves->len && !is_searched; ++j)
+			is_searched = list.moves[i] == search_moves->moves[j];
+		if (is_searched)
+			thread->root_moves[thread->num_root_moves++] = (RootMove){
+				.move = list.moves[i],
+				.score = -INFINITE,
+				.previous_score = -INFINITE,
+				.nodes = 0,
+			};
+	}
+	if (!thread->num_root_moves && search_moves->len) {
+		const MoveList all_moves = {.len = 0};
+		init_root_moves(thread, &all_moves);
+	}
+}
+
+/*
+ * The helper threads deepen until the main thread stops them. Half of them
+ * skip the first depth so that they are always one depth apart from the
+ * others.
+ */
+static void *helper_thread_search(void *arg)
+{
+	SearchThread *const thread = arg;
+	for (int depth = 1 + thread->idx % 2; depth <= MAX_DEPTH; ++depth) {
+		search(thread, depth);
+		if (search_is_stopped())
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Return the move expected as a reply to the best move, 0 if there's none.
+ * When the principal variation stops at the best move, which happens after a
+ * cutoff from the transposition table, the table may still know the reply.
+ */
+static Move get_ponder_move(SearchThread *thread)
+{
+	const Move best_move = get_best_move(thread);
+	if (!best_move)
+		return 0;
+	if (thread->lines[0].pv_len > 1)
+		return thread->lines[0].pv[1];
+	NodeData data;
+	Move move = 0;
+	make_move(thread, &thread->stack[0], best_move);
+	if (tt_get(&data, pos_get_key(thread->pos)) && data.best_move
+	    && movegen_is_move_legal(thread->pos, data.best_move))
+		move = data.best_move;
+	unmake_move(thread, best_move);
+	return move;
+}
+
+/*
+ * The best move, first among the root moves after an iteration, is clearly
+ * best when a search of the other moves at half the depth proves that none of
+ * them comes within the margin of its score. Mate scores are left alone, the
+ * search stops by itself once it can't find a shorter mate.
+ */
+static bool best_move_is_clear(SearchThread *thread, int depth)
+{
+	const int margin = 150;
+	const int best_score = thread->lines[0].score;
+	if (best_score > MATE_BOUND || best_score < -MATE_BOUND)
+		return false;
+
+	const int bound = best_score - margin;
+	SearchStack *const ss = &thread->stack[0];
+	for (size_t i = 1; i < thread->num_root_moves; ++i) {
+		const Move move = thread->root_moves[i].move;
+		make_move(thread, ss, move);
+		const int score = -alpha_beta(thread, ss + 1, depth / 2, -bound, -bound + 1, true);
+		unmake_move(thread, move);
+		count_node(thread);
+		if (search_is_stopped() || score >= bound)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Return true if the score of the search is a mate and store the number of
+ * moves to mate in mate_in, negative if the side to move is the one mated.
+ */
+static bool is_mate_score(int score, int *mate_in)
+{
+	if (score > MATE_BOUND) {
+		*mate_in = (INFINITE - score + 1) / 2;
+		return true;
+	}
+	if (score < -MATE_BOUND) {
+		*mate_in = -(INFINITE + score + 1) / 2;
+		return true;
+	}
+	return false;
+}
 
-	printf("searched %d nodes\n", nodes);
-	return best_move;
+static int get_permill(u64 part, u64 total)
+{
+	return total ? (int)(part * 1000 / total) : 0;
+}
+
+static void report_iteration(const SearchThread *thread, int depth, u64 iteration_start,
+                             u64 iteration_nodes, u64 previous_iteration_nodes,
+                             void (*report_info)(const SearchInfo *info))
+{
+	const u64 now = clock_get_time_in_ms();
+	const u64 elapsed = now - search_start_time;
+	const u64 nodes = get_total_nodes();
+	const SearchStats *const stats = &thread->stats;
+	for (size_t i = 0; i < thread->num_lines; ++i) {
+		const RootLine *const line = &thread->lines[i];
+		int mate = 0;
+		const bool is_mate = is_mate_score(line->score, &mate);
+		const SearchInfo info = {
+			.multi_pv = i + 1,
+			.depth = depth,
+			.seldepth = stats->seldepth,
+			.score = is_mate ? 0 : line->score,
+			.is_mate = is_mate,
+			.mate = mate,
+			.nodes = nodes,
+			.qnodes = get_total_qnodes(),
+			.nps = elapsed ? nodes * 1000 / elapsed : 0,
+			.time = elapsed,
+			.iteration_time = now - iteration_start,
+			.hashfull = tt_get_hashfull(),
+			.tt_hit_rate = get_permill(stats->tt_hits, stats->tt_probes),
+			.first_move_cutoff_rate = get_permill(stats->first_move_cutoffs, stats->cutoffs),
+			.branching_factor = previous_iteration_nodes
+				? (int)(iteration_nodes * 100 / previous_iteration_nodes) : 0,
+			.pv = line->pv,
+			.pv_len = line->pv_len,
+		};
+		report_info(&info);
+	}
 }
 
 /*
- * It will return 0 in case of checkmate or stalemate. If depth is less than or
- * equal to 0 the function will use a default depth.
+ * It will return 0 in case of checkmate or stalemate. If there are no limits
+ * the function will use a default depth. An infinite search doesn't return
+ * until it's stopped, even after reaching the depth limit. A search limited by
+ * time or nodes is aborted as soon as it runs out of them and the best move of
+ * the last completed iteration is returned. The number of nodes searched by
+ * all the threads is stored in nodes and the expected reply to the best move
+ * in ponder_move, if they are not NULL.
+ *
+ * The main thread searches the position stored in threads[0] by the caller,
+ * which is destroyed at the end.
  */
-Move search_get_best_move(const Position *pos, int depth)
+static Move run_search(const SearchLimits *limits, u64 *nodes, Move *ponder_move,
+                       void (*report_info)(const SearchInfo *info))
 {
 	const int default_depth = 6;
+	const int min_clear_move_depth = 8;
 	const Move null_move = 0;
+	const struct timespec poll_interval = {.tv_sec = 0, .tv_nsec = 1000000};
 
-	Position *mut_pos = pos_copy(pos);
-	if (depth <= 0 || depth > MAX_DEPTH)
+	/* Only the clock of the side to move limits the search, without it
+	 * the search is as if there was no clock. */
+	const Color side = pos_get_side_to_move(threads[0].pos);
+	const bool has_limits = limits->infinite || limits->use_clock[side]
+		|| limits->move_time > 0 || limits->nodes;
+	int depth = limits->depth > 0 ? limits->depth : MAX_DEPTH;
+	if (limits->infinite || depth > MAX_DEPTH)
+		depth = MAX_DEPTH;
+	if (limits->depth <= 0 && !has_limits)
 		depth = default_depth;
-	
-	Move best_move = null_move;
-	for (int curr_depth = 1; curr_depth <= depth; ++curr_depth)
-		best_move = search(mut_pos, curr_depth);
-	return best_move;
+
+	SearchThread *const main_thread = &threads[0];
+	search_start_time = clock_get_time_in_ms();
+	init_budget(limits, side);
+
+	tt_new_search();
+	for (size_t i = 0; i < num_threads; ++i) {
+		threads[i].idx = i;
+		if (i)
+			threads[i].pos = pos_copy(threads[0].pos);
+		init_root_moves(&threads[i], &limits->search_moves);
+		threads[i].num_lines = 0;
+		threads[i].line = 0;
+		threads[i].nodes = 0;
+		threads[i].stats = (SearchStats){.qnodes = 0};
+		threads[i].calls_since_check = 0;
+		threads[i].stack[0].ply = 0;
+		threads[i].stack[0].move = null_move;
+	}
+	size_t num_helpers = 0;
+	for (size_t i = 1; i < num_threads; ++i) {
+		if (pthread_create(&threads[i].handle, NULL, helper_thread_search, &threads[i]))
+			break;
+		++num_helpers;
+	}
+
+	Move previous_best_move = null_move;
+	int stable_iterations = 0;
+	u64 previous_iteration_nodes = 0;
+	for (int curr_depth = 1; curr_depth <= depth; ++curr_depth) {
+		const u64 iteration_start = clock_get_time_in_ms();
+		const u64 start_nodes = get_thread_nodes(main_thread);
+		main_thread->stats.seldepth = 0;
+		search(main_thread, curr_depth);
+		if (search_is_stopped())
+			break;
+		const u64 iteration_nodes = get_thread_nodes(main_thread) - start_nodes;
+		if (report_info)
+			report_iteration(main_thread, curr_depth, iteration_start, iteration_nodes,
+			                 previous_iteration_nodes, report_info);
+		previous_iteration_nodes = iteration_nodes;
+		if (get_best_move(main_thread) == previous_best_move)
+			++stable_iterations;
+		else
+			stable_iterations = 0;
+		previous_best_move = get_best_move(main_thread);
+		/* There's nothing to think about with a single legal move. */
+		if (budget.soft_time && main_thread->num_root_moves <= 1 && !budget_is_on_hold())
+			break;
+		if (soft_time_is_over(stable_iterations))
+			break;
+		/* Most of the time can be saved when no other move comes close to
+		 * the best one, but only after the search had a fair look. */
+		if (budget.soft_time && curr_depth >= min_clear_move_depth && !budget_is_on_hold()
+		    && clock_get_time_in_ms() - budget.start_time >= budget.soft_time / 4
+		    && best_move_is_clear(main_thread, curr_depth))
+			break;
+	}
+	/* The best move can't be sent before the ponder hit. */
+	while ((limits->infinite || budget_is_on_hold()) && !search_is_stopped())
+		nanosleep(&poll_interval, NULL);
+
+	atomic_store(&stop_search, true);
+	for (size_t i = 1; i <= num_helpers; ++i)
+		pthread_join(threads[i].handle, NULL);
+	const u64 total_nodes = get_total_nodes();
+	if (ponder_move)
+		*ponder_move = get_ponder_move(main_thread);
+	for (size_t i = 0; i < num_threads; ++i)
+		pos_destroy(threads[i].pos);
+	if (nodes)
+		*nodes = total_nodes;
+	return get_best_move(main_thread);
+}
+
+/*
+ * Search the position and wait for the result. See run_search.
+ */
+Move search_get_best_move(const Position *pos, const SearchLimits *limits, u64 *nodes)
+{
+	atomic_store(&stop_search, false);
+	threads[0].pos = pos_copy(pos);
+	return run_search(limits, nodes, NULL, NULL);
+}
+
+static struct background_search {
+	pthread_t handle;
+	bool running;
+	SearchLimits limits;
+	void (*report_info)(const SearchInfo *info);
+	void (*report_best_move)(Move best_move, Move ponder_move);
+} background_search = {.running = false};
+
+static void *background_search_run(void *arg)
+{
+	(void)arg;
+	Move ponder_move;
+	const Move best_move = run_search(&background_search.limits, NULL, &ponder_move,
+	                                  background_search.report_info);
+	background_search.report_best_move(best_move, ponder_move);
+	return NULL;
+}
+
+/*
+ * Start searching the position in another thread and return right away. The
+ * position is copied before returning, so the caller can change it at any
+ * time. After every iteration the search information is passed to
+ * report_info, if it's not NULL, and when the search finishes the best move and
+ * the expected reply, or 0, are passed to report_best_move, both from the
+ * search thread. Only one search can run at a time and the previous one must
+ * be waited for with search_wait.
+ */
+void search_start(const Position *pos, const SearchLimits *limits,
+                  void (*report_info)(const SearchInfo *info),
+                  void (*report_best_move)(Move best_move, Move ponder_move))
+{
+	atomic_store(&stop_search, false);
+	atomic_store(&pondering, limits->ponder);
+	threads[0].pos = pos_copy(pos);
+	background_search.limits = *limits;
+	background_search.report_info = report_info;
+	background_search.report_best_move = report_best_move;
+	if (pthread_create(&background_search.handle, NULL, background_search_run, NULL)) {
+		fprintf(stderr, "Could not create the search thread.\n");
+		exit(1);
+	}
+	background_search.running = true;
+}
+
+/*
+ * The opponent played the expected move, so the ponder search becomes a normal
+ * one and its limits start to count. It does nothing if the search isn't
+ * pondering.
+ */
+void search_ponderhit(void)
+{
+	atomic_store(&pondering, false);
+}
+
+/*
+ * Make all the search threads return as soon as possible. The best move found
+ * so far is still reported.
+ */
+void search_stop(void)
+{
+	atomic_store(&stop_search, true);
+}
+
+/*
+ * Wait until the search started with search_start has finished and reported
+ * its best move. It returns right away if there is no search.
+ */
+void search_wait(void)
+{
+	if (!background_search.running)
+		return;
+	pthread_join(background_search.handle, NULL);
+	background_search.running = false;
 }
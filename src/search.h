@@ -1,8 +1,84 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
-Move search_get_best_move(const Position *pos, int depth);
+/*
+ * The depth is in plies and it's ignored by an infinite search, which only
+ * ends when it's stopped. The times are in milliseconds. The clock of a side
+ * is only used when use_clock is true for it, and the rest of the limits are
+ * ignored when they are 0. The move overhead is the time lost between the
+ * engine sending a move and the clock stopping, it's kept in reserve.
+ *
+ * When search_moves isn't empty only the root moves in it are searched.
+ *
+ * A ponder search runs on the opponent's time, so it's infinite until
+ * search_ponderhit is called, from then on the limits apply as if the search
+ * had just started.
+ */
+typedef struct search_limits {
+	int depth;
+	bool infinite;
+	bool ponder;
+	bool use_clock[2];
+	long time[2];
+	long increment[2];
+	int moves_to_go;
+	long move_time;
+	u64 nodes;
+	long move_overhead;
+	MoveList search_moves;
+} SearchLimits;
+
+typedef struct search_parameters {
+	int reverse_futility_margin;
+	int futility_margin;
+	int razoring_margin;
+	int late_move_pruning_base;
+} SearchParameters;
+
+/*
+ * What the search reports after each iteration, once for every line searched,
+ * numbered from 1 in multi_pv from the best to the worst. The score is in
+ * centipawns unless is_mate is true, then mate is the number of moves to mate,
+ * negative if the side to move is the one mated and 0 if it already is. The
+ * rates are in
+ * permill and the branching factor, the ratio between the nodes of this
+ * iteration and the previous one, is multiplied by 100. The times are in
+ * milliseconds. The principal variation starts with the best move and belongs
+ * to the search, so it must be copied to be kept after the report.
+ */
+typedef struct search_info {
+	int multi_pv;
+	int depth;
+	int seldepth;
+	int score;
+	bool is_mate;
+	int mate;
+	u64 nodes;
+	u64 qnodes;
+	u64 nps;
+	u64 time;
+	u64 iteration_time;
+	int hashfull;
+	int tt_hit_rate;
+	int first_move_cutoff_rate;
+	int branching_factor;
+	const Move *pv;
+	int pv_len;
+} SearchInfo;
+
+Move search_get_best_move(const Position *pos, const SearchLimits *limits, u64 *nodes);
+void search_start(const Position *pos, const SearchLimits *limits,
+                  void (*report_info)(const SearchInfo *info),
+                  void (*report_best_move)(Move best_move, Move ponder_move));
+void search_ponderhit(void);
+void search_stop(void);
+void search_wait(void);
+void search_clear(void);
+void search_set_threads(size_t n);
+void search_set_multi_pv(size_t n);
+void search_set_parameters(const SearchParameters *parameters);
 void search_finish(void);
-void search_init(void);
+size_t search_set_hash_size(size_t size_mb);
+void search_init(size_t hash_size_mb);
 
 #endif
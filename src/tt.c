@@ -1,124 +1,266 @@
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "bit.h"
-#include "rng.h"
 #include "pos.h"
 #include "move.h"
 #include "tt.h"
 
 /*
- * The set of random numbers in the Zobrist array map to each possible variation
- * in the state of the position. 12 * 64 random numbers for each piece on each
- * square, 16 permutations of castling rights, 8 possible en passant files and
- * finally 1 possible variation of color when it is black instead of white.
+ * A compact transposition table entry. Only 16 bits of the key are stored to
+ * check that the entry belongs to the position, the rest of the bits that
+ * matter are implied by the bucket the entry is in. The depth is stored with
+ * an offset of one so that an empty entry, which is all zeros, never matches
+ * a position. The generation of the search that stored the entry and the node
+ * type share the last byte.
+ *
+ * The table is shared by all the search threads without locks. An entry fits
+ * in a 64-bit word, so it's always read and written as a whole and a thread
+ * never sees half of an entry written by another thread.
  */
-#define NUM_PIECES 12
-#define NUM_SQUARES 64
-#define NUM_CASTLING_RIGHTS 16
-#define NUM_EN_PASSANT_FILES 8
-#define NUM_COLOR_VARIATION 1
-#define ZOBRIST_ARRAY_SIZE (NUM_PIECES * NUM_SQUARES + NUM_CASTLING_RIGHTS +\
-                            NUM_EN_PASSANT_FILES + NUM_COLOR_VARIATION)
+struct tt_entry {
+	u16 check;
+	Move best_move;
+	int16_t score;
+	u8 depth;
+	u8 generation_and_type;
+};
+
+#define ENTRIES_PER_BUCKET 8
+#define BUCKET_SIZE 64
+
+/*
+ * A bucket fills a cache line, so probing all its entries costs a single
+ * memory access.
+ */
+struct tt_bucket {
+	_Atomic u64 entries[ENTRIES_PER_BUCKET];
+};
+
+_Static_assert(sizeof(struct tt_entry) == sizeof(u64),
+               "An entry must fit in a 64-bit word.");
+_Static_assert(sizeof(struct tt_bucket) == BUCKET_SIZE,
+               "A bucket must fill exactly one cache line.");
+
+enum {
+	TYPE_BITS = 2,
+	TYPE_MASK = (1 << TYPE_BITS) - 1,
+	GENERATION_CYCLE = 1 << (8 - TYPE_BITS),
+};
 
 struct transposition_table {
-	NodeData *ptr;
+	struct tt_bucket *ptr;
 	size_t capacity;
-} transposition_table = {.ptr = NULL, .capacity = 0};
+	u8 generation;
+} transposition_table = {.ptr = NULL, .capacity = 0, .generation = 0};
 
-static u64 zobrist_numbers[ZOBRIST_ARRAY_SIZE];
+static u16 get_check(u64 key)
+{
+	return key & 0xFFFF;
+}
 
 /*
- * Generate a set of unique random numbers for Zobrist hashing.
+ * The bucket is selected by the high half of the key multiplied by the
+ * capacity, which maps the key to [0, capacity) without a division. The low
+ * bits of the key are left for the check.
  */
-static void init_hash(void)
+static struct tt_bucket *get_bucket(u64 key)
 {
-	for (size_t i = 0; i < ZOBRIST_ARRAY_SIZE; ++i) {
-		zobrist_numbers[i] = rng_next();
-		for (size_t j = 0; j < i; ++j) {
-			if (zobrist_numbers[i] == zobrist_numbers[j])
-				--i;
-		}
-	}
+	const size_t idx = ((key >> 32) * transposition_table.capacity) >> 32;
+	return &transposition_table.ptr[idx];
 }
 
-static u64 hash(const Position *pos)
+static u8 get_entry_generation(const struct tt_entry *entry)
 {
-	u64 key = 0;
-	u64 *ptr = zobrist_numbers;
+	return entry->generation_and_type >> TYPE_BITS;
+}
 
-	for (Square sq = 0; sq < NUM_SQUARES; ++sq) {
-		const Piece piece = pos_get_piece_at(pos, sq);
-		if (piece != PIECE_NONE)
-			key ^= ptr[NUM_SQUARES * piece + sq];
-	}
-	ptr += NUM_PIECES * NUM_SQUARES;
+/*
+ * Number of searches since the entry was stored or last found. It wraps around
+ * after GENERATION_CYCLE searches.
+ */
+static int get_entry_age(const struct tt_entry *entry)
+{
+	return (transposition_table.generation - get_entry_generation(entry))
+		& (GENERATION_CYCLE - 1);
+}
 
-	u8 rights = 0;
-	for (Color color = COLOR_WHITE; color <= COLOR_BLACK; ++color) {
-		const bool has_king_right = pos_has_castling_right(pos, color, CASTLING_SIDE_KING);
-		const bool has_queen_right = pos_has_castling_right(pos, color, CASTLING_SIDE_QUEEN);
-		rights = ((has_king_right << 1) | has_queen_right) << (2 * color);
-	}
-	key ^= ptr[rights];
-	ptr += NUM_CASTLING_RIGHTS;
+static void set_entry_generation(struct tt_entry *entry)
+{
+	entry->generation_and_type = (transposition_table.generation << TYPE_BITS)
+		| (entry->generation_and_type & TYPE_MASK);
+}
 
-	if (pos_enpassant_possible(pos)) {
-		const Square sq = pos_get_enpassant(pos);
-		const File file = pos_get_file_of_square(sq);
-		key ^= ptr[file];
-	}
-	ptr += NUM_EN_PASSANT_FILES;
+/*
+ * Entries with less depth are worth less since they save less work, and old
+ * entries are worth less since they likely belong to positions that can't be
+ * reached anymore.
+ */
+static int get_entry_worth(const struct tt_entry *entry)
+{
+	return entry->depth - 8 * get_entry_age(entry);
+}
 
-	if (pos_get_side_to_move(pos) == COLOR_BLACK)
-		key ^= ptr[0];
+static struct tt_entry load_entry(_Atomic u64 *slot)
+{
+	const u64 word = atomic_load_explicit(slot, memory_order_relaxed);
+	struct tt_entry entry;
+	memcpy(&entry, &word, sizeof(entry));
+	return entry;
+}
 
-	return key;
+static void save_entry(_Atomic u64 *slot, const struct tt_entry *entry)
+{
+	u64 word;
+	memcpy(&word, entry, sizeof(word));
+	atomic_store_explicit(slot, word, memory_order_relaxed);
 }
 
 /*
  * It will return true if the node data is in the transposition table table and
- * false otherwise.
+ * false otherwise. The key is the Zobrist key of the position, which is kept
+ * updated by the position itself.
  */
-bool tt_get(NodeData *data, const Position *pos)
+bool tt_get(NodeData *data, u64 key)
 {
-	const u64 node_hash = hash(pos);
-	const size_t key = node_hash % transposition_table.capacity;
-	struct node_data tt_data = transposition_table.ptr[key];
-	if (node_hash == tt_data.hash) {
-		*data = tt_data;
+	struct tt_bucket *bucket = get_bucket(key);
+	const u16 check = get_check(key);
+	for (size_t i = 0; i < ENTRIES_PER_BUCKET; ++i) {
+		struct tt_entry entry = load_entry(&bucket->entries[i]);
+		if (entry.check != check || !entry.depth)
+			continue;
+		if (get_entry_age(&entry)) {
+			set_entry_generation(&entry);
+			save_entry(&bucket->entries[i], &entry);
+		}
+		data->score = entry.score;
+		data->depth = entry.depth - 1;
+		data->type = entry.generation_and_type & TYPE_MASK;
+		data->best_move = entry.best_move;
+		data->hash = key;
 		return true;
 	}
 	return false;
 }
 
+/*
+ * The data replaces the entry of the same position if there is one, unless
+ * that entry comes from a deeper search of the current generation and the new
+ * score isn't exact. Otherwise it takes an empty entry or the least valuable
+ * entry of the bucket.
+ */
 void tt_store(const NodeData *data)
 {
-	const size_t key = data->hash % transposition_table.capacity;
-	transposition_table.ptr[key] = *data;
+	struct tt_bucket *bucket = get_bucket(data->hash);
+	const u16 check = get_check(data->hash);
+	size_t replace_idx = 0;
+	struct tt_entry replace = load_entry(&bucket->entries[0]);
+	for (size_t i = 0; i < ENTRIES_PER_BUCKET; ++i) {
+		const struct tt_entry entry = load_entry(&bucket->entries[i]);
+		if (!entry.depth || entry.check == check) {
+			replace_idx = i;
+			replace = entry;
+			break;
+		}
+		if (get_entry_worth(&entry) < get_entry_worth(&replace)) {
+			replace_idx = i;
+			replace = entry;
+		}
+	}
+
+	const bool same_position = replace.depth && replace.check == check;
+	if (same_position && data->type != NODE_TYPE_PV && !get_entry_age(&replace)
+	    && replace.depth > data->depth + 1)
+		return;
+	if (!same_position || data->best_move)
+		replace.best_move = data->best_move;
+	replace.check = check;
+	replace.score = data->score;
+	replace.depth = data->depth + 1;
+	replace.generation_and_type = (transposition_table.generation << TYPE_BITS)
+		| data->type;
+	save_entry(&bucket->entries[replace_idx], &replace);
+}
+
+/*
+ * Return how full the table is in permill, estimated from the first thousand
+ * entries. Only the entries of the current search count, the old ones are
+ * about to be replaced.
+ */
+int tt_get_hashfull(void)
+{
+	const size_t sample_size = 1000;
+	int used = 0;
+	for (size_t i = 0; i < sample_size / ENTRIES_PER_BUCKET && i < transposition_table.capacity; ++i) {
+		for (size_t j = 0; j < ENTRIES_PER_BUCKET; ++j) {
+			const struct tt_entry entry = load_entry(&transposition_table.ptr[i].entries[j]);
+			if (entry.depth && !get_entry_age(&entry))
+				++used;
+		}
+	}
+	return used;
 }
 
-void tt_entry_init(NodeData *data, int score, int depth, NodeType type, Move best_move, const Position *pos)
+void tt_entry_init(NodeData *data, int score, int depth, NodeType type, Move best_move, u64 key)
 {
 	data->score = score;
 	data->depth = depth;
 	data->type = type;
 	data->best_move = best_move;
-	data->hash = hash(pos);
+	data->hash = key;
+}
+
+/*
+ * Entries stored from now on belong to a new search, which makes the entries
+ * of previous searches older and easier to replace.
+ */
+void tt_new_search(void)
+{
+	transposition_table.generation = (transposition_table.generation + 1)
+		% GENERATION_CYCLE;
 }
 
-void tt_init(void)
+/*
+ * Make the table use size_mb megabytes, or as close as whole buckets allow,
+ * and return its size in bytes. The entries are lost unless the size doesn't
+ * change. Any number of buckets works because the index is a multiply-shift,
+ * as long as it fits in 32 bits.
+ */
+size_t tt_resize(size_t size_mb)
 {
-	init_hash();
+	const size_t capacity = (size_mb << 20) / sizeof(struct tt_bucket);
+	const size_t size = capacity * sizeof(struct tt_bucket);
+	if (capacity == transposition_table.capacity)
+		return size;
 
-	transposition_table.capacity = 2 << 20;
-	transposition_table.ptr = calloc(transposition_table.capacity, sizeof(NodeData));
+	free(transposition_table.ptr);
+	transposition_table.capacity = capacity;
+	transposition_table.ptr = aligned_alloc(BUCKET_SIZE, size);
 	if (!transposition_table.ptr) {
-		fprintf(stderr, "Could not allocate memory");
+		fprintf(stderr, "Could not allocate memory.\n");
 		exit(1);
 	}
+	tt_clear();
+	return size;
+}
+
+/*
+ * Allocate a new empty table.
+ */
+void tt_init(size_t size_mb)
+{
+	tt_finish();
+	tt_resize(size_mb);
+}
+
+void tt_clear(void)
+{
+	memset(transposition_table.ptr, 0, transposition_table.capacity * sizeof(struct tt_bucket));
+	transposition_table.generation = 0;
 }
 
 void tt_finish(void)
@@ -23,6 +23,10 @@ typedef enum node_type {
 	NODE_TYPE_ALL,
 } NodeType;
 
+/*
+ * The data of a node as seen by the search. The transposition table stores it
+ * in a more compact form.
+ */
 typedef struct node_data {
 	int score;
 	u8 depth;
@@ -31,10 +35,14 @@ typedef struct node_data {
 	Move best_move;
 } NodeData;
 
-bool tt_get(NodeData *data, const Position *pos);
+bool tt_get(NodeData *data, u64 key);
 void tt_store(const NodeData *data);
-void tt_entry_init(NodeData *pos_data, int score, int depth, NodeType type, Move best_move, const Position *pos);
-void tt_init(void);
+int tt_get_hashfull(void);
+void tt_entry_init(NodeData *pos_data, int score, int depth, NodeType type, Move best_move, u64 key);
+void tt_new_search(void);
+size_t tt_resize(size_t size_mb);
+void tt_init(size_t size_mb);
+void tt_clear(void);
 void tt_finish(void);
 
 #endif
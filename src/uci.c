@@ -4,7 +4,10 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include <check.h>
 
@@ -13,6 +16,8 @@
 #include "move.h"
 #include "movegen.h"
 #include "search.h"
+#include "perft.h"
+#include "clock.h"
 #include "uci.h"
 
 bool newgame_has_been_run = false;
@@ -20,9 +25,73 @@ Position *current_position = NULL;
 
 static const size_t max_lan_len = 5;
 
+/*
+ * The positions searched by the bench command, a mix of openings, middle games
+ * and endgames.
+ */
+static const char *const bench_positions[] = {
+	"r3k2r/2pb1ppp/2pp1q2/p7/1nP1B3/1P2P3/P2N1PPP/R2QK2R w KQkq a6 0 14",
+	"4rrk1/2p1b1p1/p1p3q1/4p3/2P2n1p/1P1NR2P/PB3PP1/3R1QK1 b - - 2 24",
+	"r3qbrk/6p1/2b2pPp/p3pP1Q/PpPpP2P/3P1B2/2PB3K/R5R1 w - - 16 42",
+	"6k1/1R3p2/6p1/2Bp3p/3P2q1/P7/1P2rQ1K/5R2 b - - 4 44",
+	"8/8/1p2k1p1/3p3p/1p1P1P1P/1P2PK2/8/8 w - - 3 54",
+	"7r/2p3k1/1p1p1qp1/1P1Bp3/p1P2r1P/P7/4R3/Q4RK1 w - - 0 36",
+	"r1bq1rk1/pp2b1pp/n1pp1n2/3P1p2/2P1p3/2N1P2N/PP2BPPP/R1BQ1RK1 b - - 2 10",
+	"3r3k/2r4p/1p1b3q/p4P2/P2Pp3/1B2P3/3BQ1RP/6K1 w - - 3 87",
+	"2r4r/1p4k1/1Pnp4/3Qb1pq/8/4BpPp/5P2/2RR1BK1 w - - 0 42",
+	"4q1bk/6b1/7p/p1p4p/PNPpP2P/KN4P1/3Q4/4R3 b - - 0 37",
+	"2q3r1/1r2pk2/pp3pp1/2pP3p/P1Pb1BbP/1P4Q1/R3NPP1/4R1K1 w - - 2 34",
+	"1r2r2k/1b4q1/pp5p/2pPp1p1/P3Pn2/1P1B1Q1P/2R3P1/4BR1K b - - 1 37",
+	"r3kbbr/pp1n1p1P/3ppnp1/q5N1/1P1pP3/P1N1B3/2P1QP2/R3KB1R b KQq b3 0 17",
+	"8/6pk/2b1Rp2/3r4/1R1B2PP/P5K1/8/2r5 b - - 16 42",
+	"1r4k1/4ppb1/2n1b1qp/pB4p1/1n1BP1P1/7P/2PNQPK1/3RN3 w - - 8 29",
+	"8/p2B4/PkP5/4p1pK/4Pb1p/5P2/8/8 w - - 29 68",
+	"3r4/ppq1ppkp/4bnp1/2pN4/2P1P3/1P4P1/PQ3PBP/R4K2 b - - 2 20",
+	"5rr1/4n2k/4q2P/P1P2n2/3B1p2/4pP2/2N1P3/1RR1K2Q w - - 1 49",
+	"1r5k/2pq2p1/3p3p/p1pP4/4QP2/PP1R3P/6PK/8 w - - 1 51",
+	"q5k1/5ppp/1r3bn1/1B6/P1N2P2/BQ2P1P1/5K1P/8 b - - 2 34",
+	"r1b2k1r/5n2/p4q2/1ppn1Pp1/3pp1p1/NP2P3/P1PPBK2/1RQN2R1 w - - 0 22",
+	"r1bqk2r/pppp1ppp/5n2/4b3/4P3/P1N5/1PP2PPP/R1BQKB1R w KQkq - 0 5",
+	"r1bqr1k1/pp1p1ppp/2p5/8/3N1Q2/P2BB3/1PP2PPP/R3K2n b Q - 1 12",
+	"r1bq2k1/p4r1p/1pp2pp1/3p4/1P1B3Q/P2B1N2/2P3PP/4R1K1 b - - 2 19",
+	"r4qk1/6r1/1p4p1/2ppBbN1/1p5Q/P7/2P3PP/5RK1 w - - 2 25",
+	"r7/6k1/1p6/2pp1p2/7Q/8/p1P2K1P/8 w - - 0 32",
+	"r3k2r/ppp1pp1p/2nqb1pn/3p4/4P3/2PP4/PP1NBPPP/R2QK1NR w KQkq - 1 5",
+	"3r1rk1/1pp1pn1p/p1n1q1p1/3p4/Q3P3/2P5/PP1NBPPP/4RRK1 w - - 0 12",
+	"5rk1/1pp1pn1p/p3Brp1/8/1n6/5N2/PP3PPP/2R2RK1 w - - 2 20",
+	"8/1p2pk1p/p1p1r1p1/3n4/8/5R2/PP3PPP/4R1K1 b - - 3 27",
+	"8/4pk2/1p1r2p1/p1p4p/Pn5P/3R4/1P3PP1/4RK2 w - - 1 33",
+	"8/5k2/1pnrp1p1/p1p4p/P6P/4R1PK/1P3P2/4R3 b - - 1 38",
+	"8/8/1p1kp1p1/p1pr1n1p/P6P/1R4P1/1P3PK1/1R6 b - - 15 45",
+	"8/8/1p1k2p1/p1prp2p/P2n3P/6P1/1P1R1PK1/4R3 b - - 5 49",
+	"8/8/1p4p1/p1p2k1p/P2npP1P/4K1P1/1P6/3R4 w - - 6 54",
+	"8/8/1p4p1/p1p2k1p/P2n1P1P/4K1P1/1P6/6R1 b - - 6 59",
+	"8/5k2/1p4p1/p1pK3p/P2n1P1P/6P1/1P6/4R3 b - - 14 63",
+	"8/1R6/1p1K1kp1/p6p/P1p2P1P/6P1/1Pn5/8 w - - 0 67",
+	"1rb1rn1k/p3q1bp/2p3p1/2p1p3/2P1P2N/PP1RQNP1/1B3P2/4R1K1 b - - 4 23",
+	"4rrk1/pp1n1pp1/q5p1/P1pP4/2n3P1/7P/1P3PB1/R1BQ1RK1 w - - 3 22",
+	"r2qr1k1/pb1nbppp/1pn1p3/2ppP3/3P4/2PB1NN1/PP3PPP/R1BQR1K1 w - - 4 12",
+	"2r2k2/8/4P1R1/1p6/8/P4K1N/7b/2B5 b - - 0 55",
+	"6k1/5pp1/8/2bKP2P/2P5/p4PNb/B7/8 b - - 1 44",
+	"2rqr1k1/1p3p1p/p2p2p1/P1nPb3/2B1P3/5P2/1PQ2NPP/R1R4K w - - 3 25",
+	"r1b2rk1/p1q1ppbp/6p1/2Q5/8/4BP2/PPP3PP/2KR1B1R b - - 2 14",
+	"6r1/5k2/p1b1r2p/1pB1p1p1/1Pp3PP/2P1R1K1/2P2P2/3R4 w - - 1 36",
+	"rnbqkb1r/pppppppp/5n2/8/2PP4/8/PP2PPPP/RNBQKBNR b KQkq c3 0 2",
+	"2rr2k1/1p4bp/p1q1p1p1/4Pp1n/2PB4/1PN3P1/P3Q2P/2RR2K1 w - f6 0 20",
+	"3br1k1/p1pn3p/1p3n2/5pNq/2P1p3/1PN3PP/P2Q1PB1/4R1K1 w - - 0 23",
+	"2r2b2/5p2/5k2/p1r1pP2/P2pB3/1P3P2/K1P3R1/7R w - - 23 93",
+};
+static const int bench_default_depth = 5;
+
 #define OPTION_UCI_ANALYSISMODE_TYPE boolean
 #define OPTION_HASH_TYPE integer
 #define OPTION_PONDER_TYPE boolean
+#define OPTION_THREADS_TYPE integer
+#define OPTION_MOVE_OVERHEAD_TYPE integer
+#define OPTION_REVERSEFUTILITYMARGIN_TYPE integer
+#define OPTION_FUTILITYMARGIN_TYPE integer
+#define OPTION_RAZORINGMARGIN_TYPE integer
+#define OPTION_LATEMOVEPRUNINGBASE_TYPE integer
 #define OPTION_VALUE_TYPE(name) OPTION_##name##_TYPE
 
 enum option_type {
@@ -48,8 +117,24 @@ struct option {
 	{.name = "UCI_AnalyseMode", .type = OPTION_TYPE_BOOLEAN, .default_value.boolean = false, .value.boolean = false},
 	{.name = "Hash", .type = OPTION_TYPE_INTEGER, .default_value.integer = 64, .value.integer = 64, .min = 64, .max = 32768},
 	{.name = "Ponder", .type = OPTION_TYPE_BOOLEAN, .default_value.boolean = false, .value.boolean = false},
+	{.name = "Threads", .type = OPTION_TYPE_INTEGER, .default_value.integer = 1, .value.integer = 1, .min = 1, .max = 256},
+	{.name = "MultiPV", .type = OPTION_TYPE_INTEGER, .default_value.integer = 1, .value.integer = 1, .min = 1, .max = 64},
+	{.name = "Move Overhead", .type = OPTION_TYPE_INTEGER, .default_value.integer = 10, .value.integer = 10, .min = 0, .max = 5000},
+	{.name = "ReverseFutilityMargin", .type = OPTION_TYPE_INTEGER, .default_value.integer = 75, .value.integer = 75, .min = 0, .max = 1000},
+	{.name = "FutilityMargin", .type = OPTION_TYPE_INTEGER, .default_value.integer = 100, .value.integer = 100, .min = 0, .max = 1000},
+	{.name = "RazoringMargin", .type = OPTION_TYPE_INTEGER, .default_value.integer = 250, .value.integer = 250, .min = 0, .max = 1000},
+	{.name = "LateMovePruningBase", .type = OPTION_TYPE_INTEGER, .default_value.integer = 3, .value.integer = 3, .min = 0, .max = 64},
 };
 
+static const struct option *get_option(const char *name)
+{
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i) {
+		if (!strcmp(name, options[i].name))
+			return &options[i];
+	}
+	abort();
+}
+
 /*
  * I used the same promotion_to_char table for both promotions and promotions
  * with captures because the number of promotions with captures are the same
@@ -103,18 +188,16 @@ static void move_to_lan(char *lan, Move move)
 static Move lan_to_move(const char *lan, const Position *pos, bool *success)
 {
 	char test_lan[max_lan_len + 1];
-	size_t num_moves;
-	Move *moves = movegen_get_pseudo_legal_moves(pos, &num_moves);
-	for (size_t i = 0; i < num_moves; ++i) {
-		Move move = moves[i];
+	MoveList list;
+	movegen_get_legal_moves(pos, &list);
+	for (size_t i = 0; i < list.len; ++i) {
+		Move move = list.moves[i];
 		move_to_lan(test_lan, move);
 		if (!strcmp(test_lan, lan)) {
-			free(moves);
 			*success = true;
 			return move;
 		}
 	}
-	free(moves);
 
 	*success = false;
 	return 0xffff;
@@ -167,12 +250,54 @@ string:
 	return 0;
 }
 
-static void bestmove(Move move)
+/*
+ * Send the result of an iteration. The statistics that the protocol has no
+ * place for go in an info string, for tuning the search.
+ */
+static void send_search_info(const SearchInfo *info)
+{
+	char pv[info->pv_len * (max_lan_len + 1) + sizeof(" pv")];
+	char score[32];
+
+	/* Without legal moves there's no principal variation to send. */
+	pv[0] = '\0';
+	for (int i = 0; i < info->pv_len; ++i) {
+		char lan[max_lan_len + 1];
+		move_to_lan(lan, info->pv[i]);
+		strcat(pv, i ? " " : " pv ");
+		strcat(pv, lan);
+	}
+	if (info->is_mate)
+		sprintf(score, "mate %d", info->mate);
+	else
+		sprintf(score, "cp %d", info->score);
+	uci_send("info depth %d seldepth %d multipv %d score %s nodes %" PRIu64
+	         " nps %" PRIu64 " hashfull %d time %" PRIu64 "%s", info->depth,
+	         info->seldepth, info->multi_pv, score, info->nodes, info->nps,
+	         info->hashfull, info->time, pv);
+	/* The statistics are the same for every line. */
+	if (info->multi_pv != 1)
+		return;
+	uci_send("info string qnodes %" PRIu64 " tthits %d.%d%% firstcutoffs %d.%d%%"
+	         " ebf %d.%02d itertime %" PRIu64, info->qnodes,
+	         info->tt_hit_rate / 10, info->tt_hit_rate % 10,
+	         info->first_move_cutoff_rate / 10, info->first_move_cutoff_rate % 10,
+	         info->branching_factor / 100, info->branching_factor % 100,
+	         info->iteration_time);
+}
+
+static void bestmove(Move best_move, Move ponder_move)
 {
 	char lan[max_lan_len + 1];
+	char ponder_lan[max_lan_len + 1];
 
-	move_to_lan(lan, move);
-	uci_send("bestmove %s", lan);
+	move_to_lan(lan, best_move);
+	if (!ponder_move) {
+		uci_send("bestmove %s", lan);
+		return;
+	}
+	move_to_lan(ponder_lan, ponder_move);
+	uci_send("bestmove %s ponder %s", lan, ponder_lan);
 }
 
 static void readyok(void)
@@ -217,8 +342,19 @@ static void id(void)
 	uci_send("id author Aiya");
 }
 
+/*
+ * Stop the search running in the background, if any, and wait until it has
+ * sent its best move.
+ */
+static void stop_search(void)
+{
+	search_stop();
+	search_wait();
+}
+
 static void quit(void)
 {
+	stop_search();
 	if (current_position)
 		pos_destroy(current_position);
 	search_finish();
@@ -229,45 +365,271 @@ static void quit(void)
 	}
 }
 
-static void go(void)
+static void ucinewgame(void);
+
+/*
+ * Parse a non-negative integer, returning -1 if str is not one.
+ */
+static long str_to_count(const char *str)
+{
+	if (!str)
+		return -1;
+	char *endptr = NULL;
+	errno = 0;
+	const long n = strtol(str, &endptr, 10);
+	if (errno == ERANGE || endptr == str || *endptr != '\0' || n < 0)
+		return -1;
+	return n;
+}
+
+static void send_perft_info(u64 nodes, u64 time)
 {
+	const u64 nps = time ? nodes * 1000 / time : 0;
+	uci_send("info nodes %" PRIu64 " time %" PRIu64 " nps %" PRIu64,
+	         nodes, time, nps);
+}
+
+static void perft_suite(int num_threads)
+{
+	size_t len;
+	const PerftTest *tests = perft_get_suite(&len);
+	MoveList root_moves;
+	u64 root_nodes[MAX_MOVES];
+	u64 total_nodes = 0;
+	size_t failed = 0;
+
+	const u64 start = clock_get_time_in_ms();
+	for (size_t i = 0; i < len; ++i) {
+		Position *pos = pos_create(tests[i].fen);
+		const u64 nodes = perft(pos, tests[i].depth, num_threads,
+		                        &root_moves, root_nodes);
+		pos_destroy(pos);
+		total_nodes += nodes;
+		if (nodes != tests[i].nodes)
+			++failed;
+		uci_send("info string %s depth %d nodes %" PRIu64 " expected %"
+		         PRIu64 " %s", tests[i].fen, tests[i].depth, nodes,
+		         tests[i].nodes, nodes == tests[i].nodes ? "ok" : "failed");
+	}
+	send_perft_info(total_nodes, clock_get_time_in_ms() - start);
+	uci_send("info string %zu of %zu positions failed", failed, len);
+}
+
+/*
+ * Handle "go perft <depth>", "go perft suite" and "go divide <depth>", all of
+ * them optionally followed by "threads <number>". The divide variant also
+ * shows the number of leaf nodes below each root move.
+ */
+static void go_perft(bool divide)
+{
+	const char *depth_str = strtok(NULL, " ");
+	const bool suite = !divide && depth_str && !strcmp(depth_str, "suite");
+	const long depth = suite ? 0 : str_to_count(depth_str);
+	long num_threads = 1;
+
+	const char *str = strtok(NULL, " ");
+	if (str && !strcmp(str, "threads"))
+		num_threads = str_to_count(strtok(NULL, " "));
+	if (depth < 0 || num_threads < 1) {
+		fprintf(stderr, "Invalid UCI command.\n");
+		return;
+	}
+
+	if (suite) {
+		if (!newgame_has_been_run)
+			ucinewgame();
+		perft_suite(num_threads);
+		return;
+	}
 	if (!current_position) {
 		fprintf(stderr, "go command sent before position command.\n");
 		return;
 	}
 
-	int depth = 0;
+	MoveList root_moves;
+	u64 root_nodes[MAX_MOVES];
+	const u64 start = clock_get_time_in_ms();
+	const u64 nodes = perft(current_position, depth, num_threads, &root_moves,
+	                        root_nodes);
+	const u64 time = clock_get_time_in_ms() - start;
+
+	if (divide) {
+		char lan[max_lan_len + 1];
+		for (size_t i = 0; i < root_moves.len; ++i) {
+			move_to_lan(lan, root_moves.moves[i]);
+			uci_send("%s: %" PRIu64, lan, root_nodes[i]);
+		}
+	}
+	send_perft_info(nodes, time);
+}
+
+/*
+ * Read the next token as the value of a go parameter. Some GUIs send negative
+ * times when the clock runs out, so negative numbers are accepted.
+ */
+static bool read_number(long *n)
+{
+	const char *const str = strtok(NULL, " ");
+	if (!str) {
+		fprintf(stderr, "Invalid UCI command.\n");
+		return false;
+	}
+	char *endptr = NULL;
+	errno = 0;
+	*n = strtol(str, &endptr, 10);
+	if (errno == ERANGE || endptr == str || *endptr != '\0') {
+		fprintf(stderr, "Invalid UCI command.\n");
+		return false;
+	}
+	return true;
+}
+
+static void go(void)
+{
+	/* The previous search has already sent its best move by now, unless
+	 * it's an infinite search the GUI forgot to stop. */
+	stop_search();
 
 	char *str = strtok(NULL, " ");
-	while (str) {
-		if (!strcmp(str, "depth")) {
-			str = strtok(NULL, " ");
-			if (!str) {
-				fprintf(stderr, "Invalid UCI command.\n");
-				return;
+	if (str && (!strcmp(str, "perft") || !strcmp(str, "divide"))) {
+		go_perft(!strcmp(str, "divide"));
+		return;
+	}
+
+	if (!current_position) {
+		fprintf(stderr, "go command sent before position command.\n");
+		return;
+	}
+
+	SearchLimits limits = {
+		.depth = 0,
+		.infinite = false,
+		.ponder = false,
+		.use_clock = {false, false},
+		.time = {0, 0},
+		.increment = {0, 0},
+		.moves_to_go = 0,
+		.move_time = 0,
+		.nodes = 0,
+		.move_overhead = get_option("Move Overhead")->value.integer,
+		.search_moves = {.len = 0},
+	};
+
+	bool reading_search_moves = false;
+	for (; str; str = strtok(NULL, " ")) {
+		long n;
+		/* The moves to search go on until something that isn't a legal
+		 * move. */
+		if (reading_search_moves) {
+			bool success;
+			const Move move = lan_to_move(str, current_position, &success);
+			if (success && limits.search_moves.len < MAX_MOVES) {
+				limits.search_moves.moves[limits.search_moves.len++] = move;
+				continue;
 			}
-			char *endptr = NULL;
-			errno = 0;
-			depth = strtol(str, &endptr, 10);
-			if (errno == ERANGE || endptr == str || *endptr != '\0')
-				depth = 0;
-		} else {
-			break;
+			reading_search_moves = false;
+		}
+		if (!strcmp(str, "searchmoves")) {
+			reading_search_moves = true;
+		} else if (!strcmp(str, "infinite")) {
+			limits.infinite = true;
+		} else if (!strcmp(str, "ponder")) {
+			limits.ponder = true;
+		} else if (!strcmp(str, "depth")) {
+			if (!read_number(&n))
+				return;
+			limits.depth = n > 0 && n <= INT_MAX ? n : 0;
+		} else if (!strcmp(str, "wtime")) {
+			if (!read_number(&limits.time[COLOR_WHITE]))
+				return;
+			limits.use_clock[COLOR_WHITE] = true;
+		} else if (!strcmp(str, "btime")) {
+			if (!read_number(&limits.time[COLOR_BLACK]))
+				return;
+			limits.use_clock[COLOR_BLACK] = true;
+		} else if (!strcmp(str, "winc")) {
+			if (!read_number(&limits.increment[COLOR_WHITE]))
+				return;
+		} else if (!strcmp(str, "binc")) {
+			if (!read_number(&limits.increment[COLOR_BLACK]))
+				return;
+		} else if (!strcmp(str, "movestogo")) {
+			if (!read_number(&n))
+				return;
+			limits.moves_to_go = n > 0 && n <= INT_MAX ? n : 0;
+		} else if (!strcmp(str, "movetime")) {
+			if (!read_number(&limits.move_time))
+				return;
+		} else if (!strcmp(str, "nodes")) {
+			if (!read_number(&n))
+				return;
+			limits.nodes = n > 0 ? n : 0;
 		}
-		str = strtok(NULL, " ");
+		/* Parameters that aren't supported are ignored. */
 	}
 
-	Move move = search_get_best_move(current_position, depth);
-	bestmove(move);
+	search_start(current_position, &limits, send_search_info, bestmove);
 }
 
+/*
+ * Search each of the bench positions to a fixed depth, starting each search
+ * from a clear state so the result only depends on the engine itself. The
+ * total number of nodes works as a signature of the search, any change in its
+ * behaviour is likely to change it, and the nodes per second measure the speed
+ * of the build.
+ */
+static void bench(void)
+{
+	const long depth_arg = str_to_count(strtok(NULL, " "));
+	const int depth = depth_arg > 0 ? depth_arg : bench_default_depth;
+	const size_t num_positions = sizeof(bench_positions) / sizeof(bench_positions[0]);
+
+	const SearchLimits limits = {.depth = depth, .infinite = false};
+
+	stop_search();
+	if (!newgame_has_been_run)
+		ucinewgame();
+
+	u64 total_nodes = 0;
+	const u64 start = clock_get_time_in_ms();
+	for (size_t i = 0; i < num_positions; ++i) {
+		Position *pos = pos_create(bench_positions[i]);
+		u64 nodes = 0;
+		search_clear();
+		search_get_best_move(pos, &limits, &nodes);
+		pos_destroy(pos);
+		total_nodes += nodes;
+		uci_send("info string position %zu/%zu nodes %" PRIu64, i + 1,
+		         num_positions, nodes);
+	}
+	const u64 time = clock_get_time_in_ms() - start;
+	const u64 nps = time ? total_nodes * 1000 / time : 0;
+
+	uci_send("info string bench depth %d positions %zu", depth, num_positions);
+	uci_send("info string bench time %" PRIu64 " ms", time);
+	uci_send("info string bench nps %" PRIu64, nps);
+	uci_send("info string bench signature %" PRIu64, total_nodes);
+}
+
+
+/*
+ * The tables are only built once, later games just forget what the search
+ * learned, which is much cheaper than allocating a large transposition table
+ * again.
+ */
 static void ucinewgame(void)
 {
+	stop_search();
 	if (current_position)
 		pos_destroy(current_position);
-	search_finish();
+	current_position = NULL;
+	if (newgame_has_been_run) {
+		search_clear();
+		return;
+	}
 	movegen_init();
-	search_init();
+	pos_init();
+	search_init(get_option("Hash")->value.integer);
 	newgame_has_been_run = true;
 }
 
@@ -489,6 +851,27 @@ static void setoption(void)
 			break;
 		}
 	}
+	if (!strcmp(name, "Hash")) {
+		stop_search();
+		const size_t size = search_set_hash_size(value.integer);
+		uci_send("info string Hash set to %zu MB", size >> 20);
+	} else if (!strcmp(name, "Threads")) {
+		stop_search();
+		search_set_threads(value.integer);
+	} else if (!strcmp(name, "MultiPV")) {
+		stop_search();
+		search_set_multi_pv(value.integer);
+	} else if (!strcmp(name, "ReverseFutilityMargin") || !strcmp(name, "FutilityMargin")
+	           || !strcmp(name, "RazoringMargin") || !strcmp(name, "LateMovePruningBase")) {
+		stop_search();
+		const SearchParameters parameters = {
+			.reverse_futility_margin = get_option("ReverseFutilityMargin")->value.integer,
+			.futility_margin = get_option("FutilityMargin")->value.integer,
+			.razoring_margin = get_option("RazoringMargin")->value.integer,
+			.late_move_pruning_base = get_option("LateMovePruningBase")->value.integer,
+		};
+		search_set_parameters(&parameters);
+	}
 	free(name);
 	free(value_str);
 }
@@ -512,7 +895,9 @@ bool uci_interpret(const char *str)
 	strcpy(split_str, str);
 	char *const cmd = strtok(split_str, " ");
 
-	if (!strcmp(cmd, "uci")) {
+	if (!cmd) {
+		/* Empty lines are ignored. */
+	} else if (!strcmp(cmd, "uci")) {
 		uci();
 	} else if (!strcmp(cmd, "isready")) {
 		isready();
@@ -524,6 +909,12 @@ bool uci_interpret(const char *str)
 		position(split_str);
 	} else if (!strcmp(cmd, "go")) {
 		go();
+	} else if (!strcmp(cmd, "stop")) {
+		stop_search();
+	} else if (!strcmp(cmd, "ponderhit")) {
+		search_ponderhit();
+	} else if (!strcmp(cmd, "bench")) {
+		bench();
 	} else if (!strcmp(cmd, "quit")) {
 		quit();
 		ret = false;
@@ -533,13 +924,21 @@ bool uci_interpret(const char *str)
 	return ret;
 }
 
+/*
+ * The search thread sends messages too, so the lock keeps the lines of both
+ * threads from mixing.
+ */
 void uci_send(const char *fmt, ...)
 {
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 	va_list args;
 	va_start(args, fmt);
+	pthread_mutex_lock(&lock);
 	vprintf(fmt, args);
 	putchar('\n');
 	fflush(stdout);
+	pthread_mutex_unlock(&lock);
+	va_end(args);
 }
 
 /*